@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cmath>
+
+#include "BlockTriangularSolver.h"
+
+BlockTriangularSolver::BlockTriangularSolver() {}
+
+// -------------------------------- Symbolic phase --------------------------------
+// Augmenting-path matching (MC21) with an explicit stack, preceded by a cheap greedy pass.
+int BlockTriangularSolver::maximumTransversal(const Eigen::SparseMatrix<double>& A, std::vector<int>& matchedRow) {
+    const int n = static_cast<int>(A.cols());
+    const int* outer = A.outerIndexPtr();
+    const int* inner = A.innerIndexPtr();
+    matchedRow.assign(n, -1);
+    std::vector<int> matchedColumn(A.rows(), -1);
+    int matches = 0;
+
+    for (int j = 0; j < n; ++j) {
+        for (int p = outer[j]; p < outer[j + 1]; ++p) {
+            if (matchedColumn[inner[p]] == -1) {
+                matchedColumn[inner[p]] = j;
+                matchedRow[j] = inner[p];
+                ++matches;
+                break;
+            }
+        }
+    }
+
+    struct Frame { int column; int next; };
+    std::vector<int> visitedBy(A.rows(), -1);
+    std::vector<Frame> stack;
+    for (int start = 0; start < n; ++start) {
+        if (matchedRow[start] != -1)
+            continue;
+        stack.assign(1, {start, outer[start]});
+        int freeRow = -1;
+        while (!stack.empty() && freeRow == -1) {
+            Frame& frame = stack.back();
+            if (frame.next == outer[frame.column + 1]) {
+                stack.pop_back();
+                continue;
+            }
+            int row = inner[frame.next++];
+            if (visitedBy[row] == start)
+                continue;
+            visitedBy[row] = start;
+            if (matchedColumn[row] == -1)
+                freeRow = row;
+            else
+                stack.push_back({matchedColumn[row], outer[matchedColumn[row]]});
+        }
+        if (freeRow == -1)
+            continue;
+
+        // Flip the path: every column on the stack takes the row that led past it.
+        for (int k = static_cast<int>(stack.size()) - 1, row = freeRow; k >= 0; --k) {
+            int column = stack[k].column;
+            int previous = matchedRow[column];
+            matchedRow[column] = row;
+            matchedColumn[row] = column;
+            row = previous;
+        }
+        ++matches;
+    }
+    return matches;
+}
+
+bool BlockTriangularSolver::analyze(const Eigen::SparseMatrix<double>& A) {
+    blocks.clear();
+    std::vector<int> matchedRow;
+    if (A.rows() != A.cols() || maximumTransversal(A, matchedRow) != A.cols())
+        return false;
+    findBlocks(A, matchedRow);
+    return true;
+}
+
+// Tarjan's strongly connected components on the graph with an edge j -> i whenever the
+// equation matched to unknown i uses unknown j. Components come out sinks first, so the
+// solve order is the reverse of the output order.
+void BlockTriangularSolver::findBlocks(const Eigen::SparseMatrix<double>& A, const std::vector<int>& matchedRow) {
+    const int n = static_cast<int>(A.cols());
+    const int* outer = A.outerIndexPtr();
+    const int* inner = A.innerIndexPtr();
+    std::vector<int> unknownOfRow(n);
+    for (int j = 0; j < n; ++j)
+        unknownOfRow[matchedRow[j]] = j;
+
+    std::vector<int> index(n, -1), low(n, 0);
+    std::vector<bool> onStack(n, false);
+    std::vector<int> componentStack;
+    std::vector<std::vector<int>> components;
+    struct Frame { int unknown; int next; };
+    std::vector<Frame> callStack;
+    int counter = 0;
+
+    for (int root = 0; root < n; ++root) {
+        if (index[root] != -1)
+            continue;
+        index[root] = low[root] = counter++;
+        componentStack.push_back(root);
+        onStack[root] = true;
+        callStack.assign(1, {root, outer[root]});
+
+        while (!callStack.empty()) {
+            Frame& frame = callStack.back();
+            int v = frame.unknown;
+            if (frame.next < outer[v + 1]) {
+                int w = unknownOfRow[inner[frame.next++]];
+                if (index[w] == -1) {
+                    index[w] = low[w] = counter++;
+                    componentStack.push_back(w);
+                    onStack[w] = true;
+                    callStack.push_back({w, outer[w]});
+                }
+                else if (onStack[w])
+                    low[v] = std::min(low[v], index[w]);
+                continue;
+            }
+
+            callStack.pop_back();
+            if (!callStack.empty())
+                low[callStack.back().unknown] = std::min(low[callStack.back().unknown], low[v]);
+            if (low[v] == index[v]) {
+                components.emplace_back();
+                int w;
+                do {
+                    w = componentStack.back();
+                    componentStack.pop_back();
+                    onStack[w] = false;
+                    components.back().push_back(w);
+                } while (w != v);
+            }
+        }
+    }
+
+    std::vector<int> blockOf(n), localIndex(n);
+    blocks.resize(components.size());
+    for (size_t c = 0; c < components.size(); ++c) {
+        Block& block = blocks[components.size() - 1 - c];
+        block.columns = components[c];
+        std::sort(block.columns.begin(), block.columns.end()); // keep the fill-reducing numbering
+        for (size_t k = 0; k < block.columns.size(); ++k) {
+            blockOf[block.columns[k]] = static_cast<int>(components.size() - 1 - c);
+            localIndex[block.columns[k]] = static_cast<int>(k);
+            block.rows.push_back(matchedRow[block.columns[k]]);
+        }
+    }
+
+    // One pass over A sorts every entry into its block matrix or into the couplings of
+    // its row's block. The triplet values carry the entry's position in A's value array.
+    std::vector<std::vector<Eigen::Triplet<double>>> entries(blocks.size());
+    for (int j = 0; j < n; ++j) {
+        for (int p = outer[j]; p < outer[j + 1]; ++p) {
+            int owner = unknownOfRow[inner[p]];
+            Block& block = blocks[blockOf[owner]];
+            if (blockOf[j] == blockOf[owner])
+                entries[blockOf[owner]].emplace_back(localIndex[owner], localIndex[j], static_cast<double>(p));
+            else
+                block.couplings.push_back({localIndex[owner], j, p});
+        }
+    }
+    for (size_t b = 0; b < blocks.size(); ++b)
+        buildBlock(blocks[b], entries[b]);
+}
+
+void BlockTriangularSolver::buildBlock(Block& block, const std::vector<Eigen::Triplet<double>>& entries) {
+    block.couplingValues.resize(block.couplings.size());
+    if (block.columns.size() == 1) {
+        block.diagonalIndex = static_cast<int>(entries.front().value());
+        return;
+    }
+
+    int size = static_cast<int>(block.columns.size());
+    block.matrix.resize(size, size);
+    block.matrix.setFromTriplets(entries.begin(), entries.end());
+    block.matrix.makeCompressed();
+    block.valueIndex.resize(block.matrix.nonZeros());
+    for (Eigen::Index k = 0; k < block.matrix.nonZeros(); ++k)
+        block.valueIndex[k] = static_cast<int>(block.matrix.valuePtr()[k]);
+    block.lu = std::make_unique<Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::NaturalOrdering<int>>>();
+    block.lu->analyzePattern(block.matrix);
+}
+// -------------------------------- Symbolic phase --------------------------------
+
+
+// -------------------------------- Numeric phase --------------------------------
+bool BlockTriangularSolver::factorize(const Eigen::SparseMatrix<double>& A) {
+    const double* values = A.valuePtr();
+    for (auto& block : blocks) {
+        for (size_t k = 0; k < block.couplings.size(); ++k)
+            block.couplingValues[k] = values[block.couplings[k].valueIndex];
+        if (!block.lu) {
+            block.diagonal = values[block.diagonalIndex];
+            if (block.diagonal == 0.0 || !std::isfinite(block.diagonal))
+                return false;
+            continue;
+        }
+        double* blockValues = block.matrix.valuePtr();
+        for (size_t k = 0; k < block.valueIndex.size(); ++k)
+            blockValues[k] = values[block.valueIndex[k]];
+        block.lu->factorize(block.matrix);
+        if (block.lu->info() != Eigen::Success)
+            return false;
+    }
+    return true;
+}
+
+Eigen::VectorXd BlockTriangularSolver::solve(const Eigen::VectorXd& b) const {
+    return solveColumns(b);
+}
+
+Eigen::MatrixXd BlockTriangularSolver::solveColumns(const Eigen::MatrixXd& B) const {
+    Eigen::MatrixXd X(B.rows(), B.cols());
+    Eigen::MatrixXd rhs;
+    for (const auto& block : blocks) {
+        rhs.resize(block.rows.size(), B.cols());
+        for (size_t k = 0; k < block.rows.size(); ++k)
+            rhs.row(k) = B.row(block.rows[k]);
+        for (size_t k = 0; k < block.couplings.size(); ++k)
+            rhs.row(block.couplings[k].localRow) -= block.couplingValues[k] * X.row(block.couplings[k].column);
+
+        if (!block.lu) {
+            X.row(block.columns.front()) = rhs.row(0) / block.diagonal;
+            continue;
+        }
+        Eigen::MatrixXd local = block.lu->solve(rhs);
+        for (size_t k = 0; k < block.columns.size(); ++k)
+            X.row(block.columns[k]) = local.row(k);
+    }
+    return X;
+}
+// -------------------------------- Numeric phase --------------------------------
@@ -0,0 +1,57 @@
+#ifndef BLOCKTRIANGULARSOLVER_H
+#define BLOCKTRIANGULARSOLVER_H
+
+#include <Eigen/Sparse>
+#include <memory>
+#include <vector>
+
+// -------------------------------- Block Triangular Solver --------------------------------
+// Direct solver for matrices that are reducible to block triangular form. A maximum
+// transversal puts a nonzero on every diagonal position; the strongly connected
+// components of the resulting graph are the diagonal blocks, visited in dependency
+// order. Every block is factored on its own (singletons are a single division) and
+// the system is solved by block substitution.
+class BlockTriangularSolver {
+public:
+    BlockTriangularSolver();
+
+    // Symbolic phase; returns false if A is structurally singular.
+    bool analyze(const Eigen::SparseMatrix<double>& A);
+    bool factorize(const Eigen::SparseMatrix<double>& A);
+    Eigen::VectorXd solve(const Eigen::VectorXd& b) const;
+    Eigen::MatrixXd solveColumns(const Eigen::MatrixXd& B) const; // one solve per column of B
+
+    int blockCount() const { return static_cast<int>(blocks.size()); }
+
+    // matchedRow[j] is the row paired with column j, or -1. Returns the number of pairs
+    // (the structural rank of A).
+    static int maximumTransversal(const Eigen::SparseMatrix<double>& A, std::vector<int>& matchedRow);
+
+private:
+    struct Coupling {
+        int localRow;
+        int column;
+        int valueIndex;
+    };
+    struct Block {
+        std::vector<int> columns; // unknowns, in local order
+        std::vector<int> rows;    // rows of A, rows[k] is matched to columns[k]
+        std::vector<Coupling> couplings; // entries of these rows in earlier blocks
+        std::vector<double> couplingValues;
+        // singleton block
+        int diagonalIndex = -1;
+        double diagonal = 0.0;
+        // larger block
+        Eigen::SparseMatrix<double> matrix;
+        std::vector<int> valueIndex; // per nonzero of matrix: index into A's value array
+        std::unique_ptr<Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::NaturalOrdering<int>>> lu;
+    };
+
+    void findBlocks(const Eigen::SparseMatrix<double>& A, const std::vector<int>& matchedRow);
+    void buildBlock(Block& block, const std::vector<Eigen::Triplet<double>>& entries);
+
+    std::vector<Block> blocks; // in solve order
+};
+// -------------------------------- Block Triangular Solver --------------------------------
+
+#endif // BLOCKTRIANGULARSOLVER_H
@@ -1,6 +1,13 @@
 #include <iomanip>
 #include <utility>
 #include <cctype>
+#include <cmath>
+#include <complex>
+#include <numbers>
+#include <atomic>
+#include <thread>
+#include <limits>
+#include <algorithm>
 #include <QFile>
 #include <QFileDialog>
 #include <fstream>
@@ -51,7 +58,8 @@ double parseSpiceValue(const std::string& valueStr) {
 
 
 // -------------------------------- Constructors and Destructors --------------------------------
-Circuit::Circuit() : nextNodeId(0), numCurrentUnknowns(0), hasNonlinearComponents(false) { }
+Circuit::Circuit() : nextNodeId(0), circuitCompiled(false), mnaSize(0), matrixStampsValid(false),
+                     numCurrentUnknowns(0), hasNonlinearComponents(false) { }
 
 Circuit::~Circuit() {}
 // -------------------------------- Constructors and Destructors --------------------------------
@@ -112,6 +120,9 @@ void Circuit::saveToFile(const QString& filePath) {
     out << idToNodeName;
     out << (qint32)nextNodeId;
     out << groundNodeIds;
+    // Appended after the original format: older builds stop reading before it, and
+    // loadFromFile() accepts files without it.
+    out << subcircuitInstances;
 }
 
 void Circuit::loadFromFile(const QString& filePath) {
@@ -151,7 +162,11 @@ void Circuit::loadFromFile(const QString& filePath) {
     in >> idToNodeName;
     in >> loadedNextNodeId;
     in >> groundNodeIds;
+    // Projects saved before instances were recorded end here; their subcircuits stay uncondensed.
+    if (!in.atEnd())
+        in >> subcircuitInstances;
     nextNodeId = loadedNextNodeId;
+    invalidateTopology();
 }
 // -------------------------------- File Management --------------------------------
 
@@ -184,10 +199,22 @@ void Circuit::mergeNodes(int sourceNodeId, int destNodeId) {
     }
 
     idToNodeName.erase(sourceNodeId);
+    pruneSubcircuitInstances();
+    invalidateTopology();
+}
+
+void Circuit::invalidateTopology() {
+    mnaSolver.invalidate();
+    schurSolver.invalidate();
+    stampEngine.invalidate();
+    circuitCompiled = false;
+    matrixStampsValid = false;
+    operatingPoint.resize(0);
 }
 
 void Circuit::clearSchematic() {
     components.clear();
+    subcircuitInstances.clear();
     nodeNameToId.clear();
     idToNodeName.clear();
     componentCurrentIndices.clear();
@@ -201,6 +228,7 @@ void Circuit::clearSchematic() {
     labels.clear();
     grounds.clear();
     componentGraphics.clear();
+    invalidateTopology();
 }
 
 int Circuit::getNodeId(const std::string& nodeName, bool create) {
@@ -236,6 +264,7 @@ void Circuit::addComponent(const std::string& typeStr, const std::string& name,
             components.push_back(std::shared_ptr<Component>(newComp));
             if (newComp->isNonlinear())
                 hasNonlinearComponents = true;
+            invalidateTopology();
             std::cout << "Added " << name << "." << std::endl;
         }
     }
@@ -280,6 +309,12 @@ void Circuit::addComponent(const std::string& typeStr, const std::string& name,
         nodeMap[subDef.port1NodeName] = node1Str;
         nodeMap[subDef.port2NodeName] = node2Str;
 
+        SubcircuitInstance instance;
+        instance.name = name;
+        instance.definition = typeStr;
+        instance.port1NodeName = node1Str;
+        instance.port2NodeName = node2Str;
+
         for (const std::string& line : subDef.netlist) {
             std::stringstream ss(line);
             std::string subCompTypeStr, subCompName, subNode1, subNode2, subValueStr;
@@ -287,13 +322,17 @@ void Circuit::addComponent(const std::string& typeStr, const std::string& name,
 
             std::string newCompName = name + "_" + subCompName;
 
-            if (!nodeMap.count(subNode1))
-                nodeMap[subNode1] = name + "_" + subNode1;
-            if (!nodeMap.count(subNode2))
-                nodeMap[subNode2] = name + "_" + subNode2;
+            for (const std::string& subNode : {subNode1, subNode2}) {
+                if (!nodeMap.count(subNode)) {
+                    nodeMap[subNode] = name + "_" + subNode;
+                    instance.internalNodeNames.push_back(nodeMap[subNode]);
+                }
+            }
 
             addComponent(subCompTypeStr, newCompName, nodeMap.at(subNode1), nodeMap.at(subNode2), parseSpiceValue(subValueStr), {}, {}, false);
+            instance.componentNames.push_back(newCompName);
         }
+        subcircuitInstances.push_back(instance);
 
         componentGraphics.push_back({startPoint, isHorizontal, name});
         return;
@@ -309,6 +348,7 @@ void Circuit::addComponent(const std::string& typeStr, const std::string& name,
             components.push_back(std::shared_ptr<Component>(newComp));
             if (newComp->isNonlinear())
                 hasNonlinearComponents = true;
+            invalidateTopology();
             std::cout << "Added " << name << "." << std::endl;
         }
     }
@@ -335,6 +375,7 @@ void Circuit::addGround(const std::string& nodeName, const QPoint& position) {
     if (!isGround(nodeId)) {
         groundNodeIds.insert(nodeId);
         grounds.push_back({position});
+        invalidateTopology();
         std::cout << "Ground added." << std::endl;
     }
 }
@@ -344,18 +385,41 @@ void Circuit::addWire(const QPoint& start, const QPoint& end, const std::string&
 }
 
 void Circuit::deleteComponent(const std::string& componentName, char typeChar) {
+    // A subcircuit is deleted together with the devices and nodes it was unrolled into.
+    std::set<std::string> deletedNames = {componentName};
+    for (const auto& instance : subcircuitInstances) {
+        if (instance.name != componentName)
+            continue;
+        deletedNames.insert(instance.componentNames.begin(), instance.componentNames.end());
+        for (const auto& nodeName : instance.internalNodeNames) {
+            auto it = nodeNameToId.find(nodeName);
+            if (it == nodeNameToId.end())
+                continue;
+            const int nodeId = it->second;
+            idToNodeName.erase(nodeId);
+            groundNodeIds.erase(nodeId);
+            for (auto& pair : labelToNodes)
+                pair.second.erase(nodeId);
+            nodeNameToId.erase(it);
+        }
+    }
 components.erase(std::remove_if(components.begin(), components.end(), [&](const std::shared_ptr<Component>& comp) {
-    if (comp->getName() == componentName) {
+    if (deletedNames.count(comp->getName())) {
             return true;
         }
         return false;
     }), components.end());
+    subcircuitInstances.erase(std::remove_if(subcircuitInstances.begin(), subcircuitInstances.end(), [&](const SubcircuitInstance& instance) {
+        return instance.name == componentName;
+    }), subcircuitInstances.end());
+    pruneSubcircuitInstances();
     componentGraphics.erase(std::remove_if(componentGraphics.begin(), componentGraphics.end(), [&](const ComponentGraphicalInfo& g) {
         return g.name == componentName;
     }), componentGraphics.end());
     circuitNetList.erase(std::remove_if(circuitNetList.begin(), circuitNetList.end(), [&](const std::string& line) {
         return line.find(componentName) != std::string::npos;
     }), circuitNetList.end());
+    invalidateTopology();
 }
 
 void Circuit::deleteGround(const std::string& nodeName) {
@@ -371,6 +435,7 @@ void Circuit::deleteGround(const std::string& nodeName) {
     }
 
     groundNodeIds.erase(nodeId);
+    invalidateTopology();
     QPoint groundPos;
     QString qNodeName = QString::fromStdString(nodeName);
     QStringList parts = qNodeName.split('_');
@@ -423,6 +488,13 @@ void Circuit::renameNode(const std::string& oldName, const std::string& newName)
     nodeNameToId.erase(oldName);
     nodeNameToId[newName] = nodeId;
     idToNodeName[nodeId] = newName;
+    for (auto& instance : subcircuitInstances) {
+        std::replace(instance.internalNodeNames.begin(), instance.internalNodeNames.end(), oldName, newName);
+        if (instance.port1NodeName == oldName)
+            instance.port1NodeName = newName;
+        if (instance.port2NodeName == oldName)
+            instance.port2NodeName = newName;
+    }
     std::cout << "SUCCESS: Node renamed from " << oldName << " to " << newName << std::endl;
     for (auto it = circuitNetList.begin(); it != circuitNetList.end(); it++) {
         size_t i = 0;
@@ -433,6 +505,15 @@ void Circuit::renameNode(const std::string& oldName, const std::string& newName)
     }
 }
 
+// Waveform times are often in nanoseconds, below std::to_string's fixed six decimals.
+static std::string joinNumbers(const std::vector<double>& numbers) {
+    std::stringstream joined;
+    joined << std::setprecision(12);
+    for (size_t i = 0; i < numbers.size(); ++i)
+        joined << (i == 0 ? "" : " ") << numbers[i];
+    return joined.str();
+}
+
 std::vector<std::string> Circuit::generateNetlistFromComponents() const {
     std::vector<std::string> netlist;
     for (const auto& comp : components) {
@@ -446,12 +527,20 @@ std::vector<std::string> Circuit::generateNetlistFromComponents() const {
         else if (auto* vs = dynamic_cast<VoltageSource*>(comp.get())) {
             if (vs->getSourceType() == VoltageSource::SourceType::DC)
                 line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " " + std::to_string(vs->getParam1());
+            else if (vs->getSourceType() == VoltageSource::SourceType::Pulse)
+                line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " PULSE(" + joinNumbers(vs->getWaveformParams()) + ")";
+            else if (vs->getSourceType() == VoltageSource::SourceType::PWL)
+                line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " PWL(" + joinNumbers(vs->getWaveformParams()) + ")";
             else
                 line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " SIN(" + std::to_string(vs->getParam1()) + " " + std::to_string(vs->getParam2()) + " " + std::to_string(vs->getParam3()) + ")";
         }
         else if (auto* cs = dynamic_cast<CurrentSource*>(comp.get())) {
             if (cs->getSourceType() == CurrentSource::SourceType::DC)
                 line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " " + std::to_string(cs->getParam1());
+            else if (cs->getSourceType() == CurrentSource::SourceType::Pulse)
+                line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " PULSE(" + joinNumbers(cs->getWaveformParams()) + ")";
+            else if (cs->getSourceType() == CurrentSource::SourceType::PWL)
+                line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " PWL(" + joinNumbers(cs->getWaveformParams()) + ")";
             else
                 line = type_char + " " + comp->name + " " + n1_name + " " + n2_name + " SIN(" + std::to_string(cs->getParam1()) + " " + std::to_string(cs->getParam2()) + " " + std::to_string(cs->getParam3()) + ")";
         }
@@ -516,9 +605,12 @@ void Circuit::createSubcircuitDefinition(const std::string& name, const std::str
 
 
 // -------------------------------- MNA and Solver --------------------------------
-void Circuit::buildMNAMatrix(double time, double h) {
+// Resolves every device's terminals, branch currents and controlling unknowns to flat MNA
+// indices. Runs once per topology; stamping afterwards needs no map lookups.
+void Circuit::compileCircuit() {
     processLabelConnections();
-    std::map<int, int> nodeIdToMnaIndex;
+
+    nodeIdToMnaIndex.clear();
     int currentMnaIndex = 0;
     for (int i = 0; i < nextNodeId; ++i) {
         if (!isGround(i) && idToNodeName.count(i)) {
@@ -536,97 +628,394 @@ void Circuit::buildMNAMatrix(double time, double h) {
             numCurrentUnknowns++;
         }
     }
+    mnaSize = node_count + numCurrentUnknowns;
 
-    int matrix_size = node_count + numCurrentUnknowns;
-    if (matrix_size <= 0) {
-        A_mna.resize(0, 0);
-        b_mna.resize(0);
-        return;
+    for (const auto& comp : components) {
+        int idx = comp->needsCurrentUnknown() ? componentCurrentIndices.at(comp->name) : -1;
+        comp->compile(componentCurrentIndices, nodeIdToMnaIndex, idx);
     }
-    if (A_mna.rows() != matrix_size) {
-        A_mna.resize(matrix_size, matrix_size);
-        b_mna.resize(matrix_size);
+    orderUnknowns();
+    schurSolver.setInstances(compileSubcircuitInstances());
+    checkTopology();
+    circuitCompiled = true;
+}
+
+// Graph checks on the compiled topology, reported once per topology instead of being
+// discovered as a singular matrix at every solve.
+void Circuit::checkTopology() {
+    std::map<int, std::string> nodeNames;
+    for (const auto& pair : nodeIdToMnaIndex)
+        nodeNames[pair.first] = idToNodeName.at(pair.first);
+    topologyReport = TopologyChecker::check(components, nodeNames);
+
+    if (topologyReport.ok()) {
+        MNATriplets pattern;
+        for (const auto& comp : components)
+            comp->stampMatrix(pattern, 0.0, 1.0);
+        std::vector<int> singular = TopologyChecker::structurallySingular(pattern, mnaSize);
+        if (!singular.empty()) {
+            std::vector<std::string> unknowns(mnaSize);
+            for (const auto& pair : nodeIdToMnaIndex)
+                unknowns[pair.second] = "V(" + idToNodeName.at(pair.first) + ")";
+            for (const auto& pair : componentCurrentIndices)
+                unknowns[pair.second] = "I(" + pair.first + ")";
+            std::string list;
+            for (int index : singular)
+                list += (list.empty() ? "" : ", ") + unknowns[index];
+            topologyReport.errors.push_back("The circuit equations do not determine " + list + ".");
+        }
     }
-    A_mna.setZero();
-    b_mna.setZero();
 
-    for (const auto& comp : components) {
-        int idx = -1;
-        if (comp->needsCurrentUnknown()) {
-            idx = componentCurrentIndices.at(comp->name);
+    // The DC-only findings are reported by the analysis, as errors or warnings.
+    for (const auto& error : topologyReport.errors)
+        std::cout << "ERROR: " << error << std::endl;
+}
+
+// MNA indices of every subcircuit instance: internal node voltages followed by the branch
+// currents of its components, in definition order so that instances of one definition
+// line up; ground and missing entries are skipped.
+std::vector<SchurComplementSolver::Instance> Circuit::compileSubcircuitInstances() const {
+    std::vector<SchurComplementSolver::Instance> instances;
+    for (const auto& sub : subcircuitInstances) {
+        SchurComplementSolver::Instance instance;
+        instance.definition = sub.definition;
+        for (const auto& nodeName : sub.internalNodeNames) {
+            int index = mnaIndexOf(getNodeId(nodeName));
+            if (index != -1)
+                instance.internal.push_back(index);
+        }
+        for (const auto& compName : sub.componentNames) {
+            auto it = componentCurrentIndices.find(compName);
+            if (it != componentCurrentIndices.end())
+                instance.internal.push_back(it->second);
+        }
+        for (const auto& portName : {sub.port1NodeName, sub.port2NodeName}) {
+            int index = mnaIndexOf(getNodeId(portName));
+            if (index != -1)
+                instance.ports.push_back(index);
         }
-        comp->stampMNA(A_mna, b_mna, componentCurrentIndices, nodeIdToMnaIndex, time, h, idx);
+        instances.push_back(instance);
     }
+    return instances;
 }
 
-void Circuit::buildMNAMatrix_AC(double omega) {
-    processLabelConnections();
-    std::map<int, int> nodeIdToMnaIndex;
-    int currentMnaIndex = 0;
-    for (int i = 0; i < nextNodeId; ++i) {
-        if (!isGround(i) && idToNodeName.count(i)) {
-            nodeIdToMnaIndex[i] = currentMnaIndex++;
+// Drops the instance records that no longer describe a self-contained block: one of their
+// devices was deleted, or a merge joined an internal node to a port or to an outside device.
+// Their devices stay in the circuit and are solved without condensation.
+void Circuit::pruneSubcircuitInstances() {
+    subcircuitInstances.erase(std::remove_if(subcircuitInstances.begin(), subcircuitInstances.end(), [&](const SubcircuitInstance& instance) {
+        std::set<std::string> members(instance.componentNames.begin(), instance.componentNames.end());
+        // Names no longer in the circuit are skipped; looking them up must not create nodes.
+        auto nodeIdOf = [&](const std::string& nodeName) {
+            auto it = nodeNameToId.find(nodeName);
+            return it == nodeNameToId.end() ? -1 : it->second;
+        };
+        std::set<int> internal;
+        for (const auto& nodeName : instance.internalNodeNames) {
+            const int nodeId = nodeIdOf(nodeName);
+            if (nodeId != -1)
+                internal.insert(nodeId);
+        }
+        if (internal.count(nodeIdOf(instance.port1NodeName)) || internal.count(nodeIdOf(instance.port2NodeName)))
+            return true;
+        size_t found = 0;
+        for (const auto& comp : components) {
+            if (members.count(comp->name))
+                ++found;
+            else if (internal.count(comp->node1) || internal.count(comp->node2))
+                return true;
         }
+        return found != members.size();
+    }), subcircuitInstances.end());
+}
+
+// Renumbers node voltages and branch currents in a fill-reducing order computed from the
+// union of the transient and AC stamp patterns. The renumbered maps are the cached
+// permutation: they are only rebuilt when the topology is invalidated.
+void Circuit::orderUnknowns() {
+    if (mnaSize <= 1)
+        return;
+
+    MNATriplets pattern, capacitive;
+    Eigen::VectorXcd unusedRHS = Eigen::VectorXcd::Zero(mnaSize);
+    for (const auto& comp : components) {
+        comp->stampMatrix(pattern, 0.0, 1.0);
+        comp->stampMNA_AC(pattern, capacitive, unusedRHS);
     }
+    pattern.insert(pattern.end(), capacitive.begin(), capacitive.end());
+    for (int i = 0; i < mnaSize; ++i)
+        pattern.emplace_back(i, i, 0.0);
+
+    Eigen::VectorXi newIndex = MNASolver::fillReducingOrdering(pattern, mnaSize);
+    for (auto& pair : nodeIdToMnaIndex)
+        pair.second = newIndex(pair.second);
+    for (auto& pair : componentCurrentIndices)
+        pair.second = newIndex(pair.second);
 
-    int node_count = nodeIdToMnaIndex.size();
-    numCurrentUnknowns = 0;
-    componentCurrentIndices.clear();
     for (const auto& comp : components) {
-        if (comp->needsCurrentUnknown()) {
-            componentCurrentIndices[comp->name] = node_count + numCurrentUnknowns;
-            numCurrentUnknowns++;
-        }
+        int idx = comp->needsCurrentUnknown() ? componentCurrentIndices.at(comp->name) : -1;
+        comp->compile(componentCurrentIndices, nodeIdToMnaIndex, idx);
+    }
+}
+
+int Circuit::mnaIndexOf(int nodeId) const {
+    auto it = nodeIdToMnaIndex.find(nodeId);
+    return (it == nodeIdToMnaIndex.end()) ? -1 : it->second;
+}
+
+// Re-stamps the RHS on every call; the matrix values are written by the stamp engine,
+// which only recomputes the parts that can have changed. Returns whether A_mna changed.
+bool Circuit::buildMNAMatrix(double time, double h) {
+    if (!circuitCompiled)
+        compileCircuit();
+
+    int matrix_size = mnaSize;
+    if (matrix_size <= 0) {
+        A_mna.resize(0, 0);
+        b_mna.resize(0);
+        return true;
     }
-    int matrix_size = node_count + numCurrentUnknowns;
-    if (matrix_size <= 0)
-        return;
-    A_mna.resize(matrix_size, matrix_size);
-    b_mna.resize(matrix_size);
-    A_mna.setZero();
-    b_mna.setZero();
 
+    if (!stampEngine.isBuilt()) {
+        stampEngine.build(components, matrix_size, time, h);
+        matrixStampsValid = false;
+    }
+    if (!matrixStampsValid) {
+        stampEngine.attach(A_mna);
+        matrixStampsValid = true;
+    }
+    bool matrixChanged = stampEngine.assemble(A_mna, time, h, integrationStep.alpha);
+
+    if (b_mna.size() != matrix_size)
+        b_mna.resize(matrix_size);
+    b_mna.setZero();
     for (const auto& comp : components) {
-        int idx = -1;
-        if (comp->needsCurrentUnknown()) {
-            idx = componentCurrentIndices.at(comp->name);
-        }
-        comp->stampMNA_AC(A_mna, b_mna, componentCurrentIndices, nodeIdToMnaIndex, omega, idx);
+        // An AC source only drives the small-signal circuit; its DC value (h = 0) is zero.
+        if (h == 0.0 && comp->type == Component::Type::AC_VOLTAGE_SOURCE)
+            continue;
+        comp->stampRHS(b_mna, time, h);
     }
+
+    return matrixChanged;
+}
+
+// Stamps the frequency-independent G and C parts once; setACFrequency() then only
+// rewrites the values of A_ac for each sweep point.
+void Circuit::buildMNAMatrix_AC() {
+    if (!circuitCompiled)
+        compileCircuit();
+
+    int matrix_size = mnaSize;
+    A_ac.resize(0, 0);
+    acStampValues.clear();
+    if (matrix_size <= 0)
+        return;
+
+    MNATriplets G_triplets, C_triplets;
+    b_ac = Eigen::VectorXcd::Zero(matrix_size);
+    for (const auto& comp : components)
+        comp->stampMNA_AC(G_triplets, C_triplets, b_ac);
+
+    std::vector<Eigen::Triplet<std::complex<double>>> triplets;
+    triplets.reserve(G_triplets.size() + C_triplets.size());
+    for (const auto& t : G_triplets)
+        triplets.emplace_back(t.row(), t.col(), std::complex<double>(t.value(), 0.0));
+    for (const auto& t : C_triplets)
+        triplets.emplace_back(t.row(), t.col(), std::complex<double>(0.0, t.value()));
+
+    A_ac.resize(matrix_size, matrix_size);
+    A_ac.setFromTriplets(triplets.begin(), triplets.end());
+    A_ac.makeCompressed();
+    acStampValues.assign(A_ac.valuePtr(), A_ac.valuePtr() + A_ac.nonZeros());
+}
+
+void Circuit::setACFrequency(Eigen::SparseMatrix<std::complex<double>>& A, double omega) const {
+    std::complex<double>* values = A.valuePtr();
+    for (size_t k = 0; k < acStampValues.size(); ++k)
+        values[k] = std::complex<double>(acStampValues[k].real(), omega * acStampValues[k].imag());
 }
 
-Eigen::VectorXd Circuit::solveMNASystem() {
-    if (A_mna.rows() == 0) {
+// Solves A x = b_mna, where A is A_mna or a matrix derived from it (the DC system).
+// initialGuess (or else the last stored time point) seeds the iterative backend.
+Eigen::VectorXd Circuit::solveMNASystem(const Eigen::SparseMatrix<double>& A, bool reuseFactorization, const Eigen::VectorXd& initialGuess) {
+    if (A.rows() == 0) {
         std::cout << "MNA matrix is empty. Cannot solve." << std::endl;
         return Eigen::VectorXd();
     }
 
-    Eigen::FullPivLU<Eigen::MatrixXd> lu(A_mna);
-    if (!lu.isInvertible()) {
-        std::cout << "ERROR: Circuit matrix is singular. Check for floating nodes or invalid connections." << std::endl;
+    const Eigen::VectorXd& guess = (initialGuess.size() == 0 && !transientSolutions.empty()) ? transientSolutions.rbegin()->second : initialGuess;
+
+    if (!factorizeMNASystem(A, reuseFactorization))
         return Eigen::VectorXd(); // Return empty vector
+    if (condensingSubcircuits())
+        return schurSolver.solve(b_mna);
+    return mnaSolver.solve(b_mna, guess);
+}
+
+// Solves against whatever matrix was factorized last, e.g. a stale Jacobian.
+Eigen::VectorXd Circuit::solveWithFactorization(const Eigen::VectorXd& rhs) {
+    if (condensingSubcircuits())
+        return schurSolver.solve(rhs);
+    return mnaSolver.solve(rhs, Eigen::VectorXd::Zero(rhs.size()));
+}
+
+bool Circuit::condensingSubcircuits() const {
+    return simulationOptions.condenseSubcircuits && !subcircuitInstances.empty();
+}
+
+// Factors A with the Schur complement solver or the MNA solver. With reuseFactorization
+// the caller guarantees that A has not changed since the last factorization.
+bool Circuit::factorizeMNASystem(const Eigen::SparseMatrix<double>& A, bool reuseFactorization) {
+    bool factorized = condensingSubcircuits()
+        ? (reuseFactorization && schurSolver.isFactorized()) || schurSolver.factorize(A)
+        : (reuseFactorization && mnaSolver.isFactorized()) || mnaSolver.factorize(A);
+    if (!factorized)
+        std::cout << "ERROR: Circuit matrix is numerically singular." << std::endl;
+    return factorized;
+}
+
+void Circuit::applySolverOptions() {
+    mnaSolver.setBackend(simulationOptions.linearSolver, simulationOptions.iterativeSettings);
+    mnaSolver.setBlockTriangularForm(simulationOptions.blockTriangularForm);
+    mnaSolver.setLowRankUpdates(simulationOptions.lowRankUpdates, simulationOptions.maxUpdateRank);
+}
+
+Eigen::MatrixXd Circuit::solveMNAColumns(const Eigen::MatrixXd& rhs, double time, double h) {
+    if (!circuitCompiled)
+        compileCircuit();
+    if (!topologyReport.ok())
+        return Eigen::MatrixXd();
+    // h = 0 is the DC system, which the DC-only findings make singular as well.
+    if (h == 0.0 && !topologyReport.ok(true)) {
+        for (const auto& error : topologyReport.dcErrors)
+            std::cout << "ERROR: " << error << std::endl;
+        return Eigen::MatrixXd();
+    }
+    if (rhs.rows() != mnaSize) {
+        std::cout << "ERROR: Right-hand sides have " << rhs.rows() << " rows, the MNA system has " << mnaSize << " unknowns." << std::endl;
+        return Eigen::MatrixXd();
     }
-    return lu.solve(b_mna);
+
+    applySolverOptions();
+    // The companion models are those of a run of constant steps h with the configured
+    // method, not whatever step the last analysis ended on; h = 0 gives the DC system.
+    integrationStep = h == 0.0 ? IntegrationStep() : IntegrationStep::make(simulationOptions.integrationMethod, h, h);
+    for (const auto& comp : components)
+        comp->setIntegrationStep(integrationStep);
+    buildMNAMatrix(time, h);
+    if (A_mna.rows() == 0 || !factorizeMNASystem(A_mna, false))
+        return Eigen::MatrixXd();
+    if (condensingSubcircuits())
+        return schurSolver.solveColumns(rhs);
+    return mnaSolver.solveColumns(rhs);
+}
+
+int Circuit::getUnknownIndex(const std::string& unknown) {
+    if (!circuitCompiled)
+        compileCircuit();
+    if (unknown.length() < 4 || unknown[1] != '(' || unknown.back() != ')')
+        return -1;
+    std::string name = unknown.substr(2, unknown.length() - 3);
+    if (unknown[0] == 'V')
+        return hasNode(name) ? mnaIndexOf(nodeNameToId.at(name)) : -1;
+    if (unknown[0] == 'I') {
+        auto it = componentCurrentIndices.find(name);
+        return it == componentCurrentIndices.end() ? -1 : it->second;
+    }
+    return -1;
 }
 
-void Circuit::updateComponentStates(const Eigen::VectorXd& solution, const std::map<int, int>& nodeIdToMnaIndex) {
+void Circuit::updateComponentStates(const Eigen::VectorXd& solution) {
     for (const auto& comp : components) {
-        comp->updateState(solution, componentCurrentIndices, nodeIdToMnaIndex);
+        if (!comp->isNonlinear())
+            comp->updateState(solution);
     }
+    updateNonlinearComponentStates(solution);
 }
 
-void Circuit::updateNonlinearComponentStates(const Eigen::VectorXd& solution,
-                                             const std::map<int, int>& nodeIdToMnaIndex) {
+// Re-linearizes the nonlinear devices at solution, bypassing those that have not moved.
+// Returns how many devices were actually re-evaluated.
+int Circuit::updateNonlinearComponentStates(const Eigen::VectorXd& solution) {
+    int evaluated = 0;
     for (const auto& comp : components) {
-        if (comp->isNonlinear()) {
-            comp->updateState(solution, componentCurrentIndices, nodeIdToMnaIndex);
+        if (!comp->isNonlinear())
+            continue;
+        if (simulationOptions.deviceBypass && comp->canBypass(solution, simulationOptions.bypassVoltageTolerance)) {
+            ++analysisStats.bypassedEvaluations;
+            continue;
+        }
+        comp->updateState(solution);
+        ++evaluated;
+        if (comp->stateLimited())
+            ++analysisStats.limitedEvaluations;
+    }
+    analysisStats.deviceEvaluations += evaluated;
+    return evaluated;
+}
+
+// Extrapolates the solution at t with the Lagrange polynomial through the last accepted
+// points. Empty when there is too little history or the last point is a breakpoint.
+Eigen::VectorXd Circuit::predictSolution(double t) const {
+    const int order = std::min(simulationOptions.newtonPredictorOrder, static_cast<int>(transientSolutions.size()) - 1);
+    if (order < 1 || restartIntegration)
+        return Eigen::VectorXd();
+
+    std::vector<std::map<double, Eigen::VectorXd>::const_reverse_iterator> points;
+    for (auto it = transientSolutions.rbegin(); static_cast<int>(points.size()) <= order; ++it)
+        points.push_back(it);
+
+    Eigen::VectorXd prediction = Eigen::VectorXd::Zero(points.front()->second.size());
+    for (const auto& j : points) {
+        double weight = 1.0;
+        for (const auto& m : points) {
+            if (m != j)
+                weight *= (t - m->first) / (j->first - m->first);
         }
+        prediction += weight * j->second;
+    }
+    return prediction;
+}
+
+// Newton's absolute tolerance per unknown: volts for nodes, amperes for branch currents.
+void Circuit::setNewtonTolerances() {
+    newtonAbsTol = Eigen::VectorXd::Constant(mnaSize, simulationOptions.newtonVoltageAbsTol);
+    for (const auto& pair : componentCurrentIndices)
+        newtonAbsTol(pair.second) = simulationOptions.newtonCurrentAbsTol;
+}
+
+// errorScale estimates the remaining error from the last update (1 for full Newton).
+bool Circuit::newtonConverged(const Eigen::VectorXd& solution, const Eigen::VectorXd& lastSolution, double errorScale) const {
+    return errorScale * newtonUpdateRatio(solution, lastSolution) <= 1.0;
+}
+
+// The largest change of an unknown in units of its Newton tolerance (NaN if one is not finite).
+double Circuit::newtonUpdateRatio(const Eigen::VectorXd& solution, const Eigen::VectorXd& lastSolution) const {
+    double ratio = 0.0;
+    for (Eigen::Index i = 0; i < solution.size(); ++i) {
+        const double tolerance = simulationOptions.newtonRelTol * std::max(std::abs(solution(i)), std::abs(lastSolution(i))) + newtonAbsTol(i);
+        const double change = std::abs(solution(i) - lastSolution(i)) / tolerance;
+        if (std::isnan(change))
+            return change;
+        ratio = std::max(ratio, change);
     }
+    return ratio;
 }
 // -------------------------------- MNA and Solver --------------------------------
 
 
 // -------------------------------- Analysis Methods --------------------------------
+void Circuit::setSimulationOptions(const SimulationOptions& options) {
+    simulationOptions = options;
+}
+
+const SimulationOptions& Circuit::getSimulationOptions() const {
+    return simulationOptions;
+}
+
+const AnalysisStats& Circuit::getAnalysisStats() const {
+    return analysisStats;
+}
+
 void Circuit::runTransientAnalysis(double stopTime, double startTime, double maxTimeStep) {
     if (maxTimeStep == 0.0)
         maxTimeStep = (stopTime - startTime) / 100;
@@ -637,58 +1026,630 @@ void Circuit::runTransientAnalysis(double stopTime, double startTime, double max
         std::cout << "No ground node detected." << std::endl;
         return;
     }
+    if (!circuitCompiled)
+        compileCircuit();
+    if (!topologyReport.ok()) {
+        std::cout << "ERROR: Transient analysis aborted because of the topology errors above." << std::endl;
+        return;
+    }
+    // Without an operating point the run never solves the DC system, and the DC-only
+    // findings are just warnings; findOperatingPoint() rejects them.
+    if (!simulationOptions.transientFromOperatingPoint) {
+        for (const auto& warning : topologyReport.dcErrors)
+            std::cout << "Warning: " << warning << std::endl;
+    }
 
     for (const auto& comp : components)
         comp->reset();
     transientSolutions.clear();
+    integrationStep = IntegrationStep();
+    restartIntegration = false;
+    jacobianFactorized = false;
+    analysisStats = AnalysisStats();
+    applySolverOptions();
+    setNewtonTolerances();
+    // The operating point charges the capacitors and sets the inductor currents.
+    if (simulationOptions.transientFromOperatingPoint && !findOperatingPoint(startTime)) {
+        std::cout << "ERROR: Transient analysis aborted, no DC operating point." << std::endl;
+        return;
+    }
 
-    std::map<int, int> nodeIdToMnaIndex;
-    Eigen::VectorXd solution;
+    auto advance = [&](double t, double h, bool atBreakpoint) {
+        bool converged;
+        Eigen::VectorXd solution = solveTimePoint(t, h, converged);
+        if (!converged)
+            std::cout << "Warning: Transient analysis did not converge at t = " << t << "s" << std::endl;
+        if (solution.size() == 0) {
+            std::cout << "ERROR at t = " << t << "s: Simulation stopped." << std::endl;
+            return false;
+        }
+        acceptTimePoint(t, solution, atBreakpoint);
+        return true;
+    };
 
-    int currentMnaIndex = 0;
-    for (int i = 0; i < nextNodeId; ++i) {
-        if (idToNodeName.count(i) && !isGround(i)) {
-            nodeIdToMnaIndex[i] = currentMnaIndex++;
+    if (simulationOptions.adaptiveTimeStep) {
+        if (!runAdaptiveTransient(startTime, stopTime, maxTimeStep))
+            return;
+    }
+    else {
+        // Source corners between two grid points become extra time points, so that a pulse
+        // edge is neither skipped nor smeared over a whole step; a corner on a grid point
+        // marks that point as a breakpoint.
+        const double gap = maxTimeStep * 1e-9;
+        double last = startTime;
+        for (double t = startTime; t <= stopTime; t += maxTimeStep) {
+            double h = maxTimeStep;
+            bool atBreakpoint = false;
+            if (!transientSolutions.empty()) {
+                double b = nextBreakpoint(last + gap);
+                for (; b < t - gap; b = nextBreakpoint(b + gap)) {
+                    if (!advance(b, b - last, true))
+                        return;
+                    last = b;
+                    h = t - last;
+                }
+                atBreakpoint = b <= t + gap;
+            }
+            if (!advance(t, h, atBreakpoint))
+                return;
+            last = t;
+        }
+    }
+    std::cout << "Transient analysis complete. " << transientSolutions.size() << " time points stored, " << analysisStats.acceptedSteps
+              << " steps accepted, " << analysisStats.rejectedSteps << " rejected, " << analysisStats.newtonIterations << " Newton iterations, "
+              << analysisStats.bypassedEvaluations << " device evaluations bypassed." << std::endl;
+}
+
+bool Circuit::runOperatingPointAnalysis(double time) {
+    std::cout << "\n---------- Performing Operating Point Analysis ----------" << std::endl;
+    if (groundNodeIds.empty()) {
+        std::cout << "No ground node detected." << std::endl;
+        return false;
+    }
+    analysisStats = AnalysisStats();
+    if (!findOperatingPoint(time))
+        return false;
+    std::cout << "Operating point found in " << analysisStats.newtonIterations << " Newton iterations." << std::endl;
+    return true;
+}
+
+// Plain Newton first, then gmin stepping, then source stepping. On success operatingPoint
+// holds the solution and every device's state is set from it.
+bool Circuit::findOperatingPoint(double time) {
+    operatingPoint.resize(0);
+    if (!circuitCompiled)
+        compileCircuit();
+    if (!topologyReport.ok(true)) {
+        for (const auto& error : topologyReport.dcErrors)
+            std::cout << "ERROR: " << error << std::endl;
+        std::cout << "ERROR: Operating point analysis aborted because of the topology errors above." << std::endl;
+        return false;
+    }
+    if (mnaSize <= 0) {
+        std::cout << "MNA matrix is empty. Cannot solve." << std::endl;
+        return false;
+    }
+    applySolverOptions();
+    setNewtonTolerances();
+
+    // The DC system is the transient one at h = 0, where the companion models of capacitors
+    // and inductors reduce to open and short circuits.
+    integrationStep = IntegrationStep();
+    for (const auto& comp : components) {
+        comp->reset();
+        comp->setIntegrationStep(integrationStep);
+    }
+
+    std::vector<bool> isBranchCurrent(mnaSize, false);
+    for (const auto& pair : componentCurrentIndices)
+        isBranchCurrent[pair.second] = true;
+    MNATriplets shunts;
+    for (int i = 0; i < mnaSize; ++i) {
+        if (!isBranchCurrent[i])
+            shunts.emplace_back(i, i, 1.0);
+    }
+    nodeShunts.resize(mnaSize, mnaSize);
+    nodeShunts.setFromTriplets(shunts.begin(), shunts.end());
+
+    sourceRHS = Eigen::VectorXd::Zero(mnaSize);
+    for (const auto& comp : components) {
+        if (comp->type == Component::Type::VOLTAGE_SOURCE || comp->type == Component::Type::CURRENT_SOURCE)
+            comp->stampRHS(sourceRHS, time, 0.0);
+    }
+
+    bool converged;
+    Eigen::VectorXd solution = solveOperatingPointStage(time, simulationOptions.operatingPointGmin, 1.0, converged);
+    if (solution.size() != 0 && !converged) {
+        std::cout << "Newton did not converge on the operating point." << std::endl;
+        if (simulationOptions.gminStepping) {
+            std::cout << "Trying gmin stepping..." << std::endl;
+            solution = stepOperatingPoint(time, false, converged);
+        }
+        if (solution.size() != 0 && !converged && simulationOptions.sourceStepping) {
+            std::cout << "Trying source stepping..." << std::endl;
+            solution = stepOperatingPoint(time, true, converged);
         }
     }
+    // A singular DC system (e.g. an inductor across a voltage source) is no convergence
+    // problem; no homotopy is tried on it.
+    if (solution.size() == 0) {
+        std::cout << "ERROR: Operating point analysis stopped." << std::endl;
+        return false;
+    }
+    if (!converged) {
+        std::cout << "ERROR: No DC operating point found." << std::endl;
+        return false;
+    }
+    operatingPoint = solution;
+    updateComponentStates(operatingPoint);
+    return true;
+}
 
-    for (double t = startTime; t <= stopTime; t += maxTimeStep) {
-        if (!hasNonlinearComponents) {
-            buildMNAMatrix(t, maxTimeStep);
-            solution = solveMNASystem();
+// One Newton solve of the DC system with every node shunted to ground by gmin and the
+// independent sources scaled by sourceScale, starting from the present linearization of
+// the nonlinear devices. Empty when the system is singular.
+Eigen::VectorXd Circuit::solveOperatingPointStage(double time, double gmin, double sourceScale, bool& converged) {
+    // The shunts go into a copy: A_mna carries the stamp engine's pattern.
+    Eigen::SparseMatrix<double> A_dc;
+    auto assemble = [&]() {
+        buildMNAMatrix(time, 0.0);
+        b_mna += (sourceScale - 1.0) * sourceRHS;
+        A_dc = A_mna + gmin * nodeShunts;
+    };
+    return iterateNewton(assemble, A_dc, false, 0.0, true, Eigen::VectorXd(), false, converged);
+}
+
+// Continuation for circuits plain Newton cannot solve: a parameter p goes from 0 to 1 and
+// each stage starts from the solution of the one before. Gmin stepping lowers the node
+// shunts log-uniformly from 1e-2 S to operatingPointGmin; source stepping (rampSources)
+// ramps every independent source up from zero. A stage that fails is retried from the last
+// converged one with a quarter of the step; the step doubles after each success. Returns
+// the last converged stage, or an empty vector when a stage is singular.
+Eigen::VectorXd Circuit::stepOperatingPoint(double time, bool rampSources, bool& converged) {
+    const double gmin = simulationOptions.operatingPointGmin;
+    const double decades = std::max(0.0, std::log10(1e-2 / gmin));
+    auto solveStage = [&](double p, bool& stageConverged) {
+        ++analysisStats.homotopyStages;
+        if (rampSources)
+            return solveOperatingPointStage(time, gmin, p, stageConverged);
+        return solveOperatingPointStage(time, gmin * std::pow(10.0, decades * (1.0 - p)), 1.0, stageConverged);
+    };
+
+    for (const auto& comp : components) {
+        if (comp->isNonlinear())
+            comp->reset();
+    }
+    Eigen::VectorXd last = solveStage(0.0, converged);
+    if (last.size() == 0 || !converged)
+        return last;
+
+    double p = 0.0, step = 0.1;
+    while (p < 1.0) {
+        const double next = std::min(1.0, p + step);
+        Eigen::VectorXd stage = solveStage(next, converged);
+        if (stage.size() == 0)
+            return stage;
+        if (converged) {
+            p = next;
+            last = stage;
+            step *= 2.0;
+            continue;
+        }
+        step *= 0.25;
+        if (step < 1e-6)
+            return last;
+        for (const auto& comp : components) {
+            if (comp->isNonlinear())
+                comp->linearizeAt(last);
+        }
+    }
+    converged = true;
+    return last;
+}
+
+// Solves the circuit at time t for a step h from the accepted component states, iterating
+// the nonlinear devices to convergence. The reactive histories are left untouched, so a
+// rejected step needs no rollback.
+Eigen::VectorXd Circuit::solveTimePoint(double t, double h, bool& converged) {
+    beginTimeStep(h);
+    if (!hasNonlinearComponents) {
+        // With a fixed step and only linear devices the matrix is identical at every step.
+        bool matrixChanged = buildMNAMatrix(t, h);
+        converged = true;
+        return solveMNASystem(A_mna, simulationOptions.reuseLinearFactorization && !matrixChanged);
+    }
+
+    // Chord Newton starts from the last accepted point, at which the devices are linearized.
+    // A matrix whose companion conductances (alpha C / h, alpha L / h) are more than 30% off
+    // the current ones is not reused.
+    const bool chord = simulationOptions.chordNewton;
+    const double stepScale = integrationStep.alpha / h;
+    bool refactor = !chord || !jacobianFactorized || transientSolutions.empty() ||
+                    std::abs(stepScale - jacobianStepScale) > 0.3 * jacobianStepScale;
+    Eigen::VectorXd start;
+    bool limited = false;
+    if (chord && !transientSolutions.empty())
+        start = transientSolutions.rbegin()->second;
+
+    // Linearizing the devices at the predicted point also lets the first solve converge.
+    Eigen::VectorXd prediction = predictSolution(t);
+    if (prediction.size() != 0) {
+        const long limitedBefore = analysisStats.limitedEvaluations;
+        updateNonlinearComponentStates(prediction);
+        limited = analysisStats.limitedEvaluations != limitedBefore;
+        refactor = refactor || limited;
+        start = prediction;
+    }
+
+    return iterateNewton([&]() { buildMNAMatrix(t, h); }, A_mna, chord, stepScale, refactor, start, limited, converged);
+}
+
+// The Newton iteration of time points and DC stages. assemble() restamps A and b_mna at the
+// devices' present linearization, which is at start (empty: no start point) and was limited
+// if limited is set. With chord set, iterations keep the last factorized Jacobian, whose
+// companion models use stepScale = alpha / h, and step x += J^-1 (b - A x) until refactor
+// is forced. The result is empty when the matrix cannot be factorized.
+Eigen::VectorXd Circuit::iterateNewton(const std::function<void()>& assemble, const Eigen::SparseMatrix<double>& A, bool chord,
+                                       double stepScale, bool refactor, const Eigen::VectorXd& start, bool limited, bool& converged) {
+    converged = false;
+    Eigen::VectorXd solution, lastSolution = start;
+    // Residual of the circuit equations at lastSolution, when every device is linearized there.
+    double lastResidual = std::numeric_limits<double>::infinity();
+    double lastUpdateNorm = 0.0;
+
+    assemble();
+    for (int i = 0; i < simulationOptions.newtonMaxIterations; ++i) {
+        const bool freshJacobian = refactor;
+        if (freshJacobian) {
+            solution = solveMNASystem(A, false, lastSolution);
+            ++analysisStats.jacobianFactorizations;
+            if (solution.size() == 0)
+                return solution;
+            if (chord) {
+                // A matrix linearized at a limited junction is a poor chord Jacobian.
+                jacobianFactorized = !limited;
+                jacobianStepScale = stepScale;
+            }
         }
         else {
-            const int MAX_ITERATIONS = 100;
-            const double TOLERANCE = 1e-6;
-            bool converged = false;
-            Eigen::VectorXd lastSolution;
-
-            for (int i = 0; i < MAX_ITERATIONS; ++i) {
-                buildMNAMatrix(t, maxTimeStep);
-                solution = solveMNASystem();
-                if (solution.size() == 0) break;
-
-                if (i > 0 && (solution - lastSolution).norm() < TOLERANCE) {
-                    converged = true;
-                    break;
-                }
-                lastSolution = solution;
-                updateNonlinearComponentStates(solution, nodeIdToMnaIndex);
+            solution = solveWithFactorization(b_mna - A * lastSolution);
+            if (solution.size() != 0)
+                solution += lastSolution;
+        }
+        ++analysisStats.newtonIterations;
+        if (solution.size() == 0) break;
+        // A stale Jacobian converges linearly with some rate theta, leaving an error of about
+        // theta / (1 - theta) times the update; a small update alone proves nothing, since a
+        // Jacobian stiffer than the circuit also gives small updates. The first update of a
+        // time point also carries the parts that J resolves exactly (source steps), so theta
+        // is only measured from the second one on.
+        bool canConverge = lastSolution.size() != 0 && !limited;
+        double errorScale = 1.0;
+        if (chord && lastSolution.size() != 0) {
+            const double updateNorm = (solution - lastSolution).lpNorm<Eigen::Infinity>();
+            // Updates at roundoff level carry no rate.
+            const bool roundoff = updateNorm <= 1e-12 * solution.lpNorm<Eigen::Infinity>();
+            refactor = false;
+            if (!freshJacobian) {
+                const double theta = roundoff ? 0.0 : (lastUpdateNorm > 0.0 ? updateNorm / lastUpdateNorm : 1.0);
+                canConverge = canConverge && theta < 1.0;
+                // Unlike a quadratic iteration, a linear one stops right at the tolerance;
+                // keeping it 10x tighter stops that error from accumulating in the states.
+                errorScale = 10.0 * theta / (1.0 - theta);
+                // A refactorization costs one LU, after which Newton converges quadratically in
+                // one or two iterations; a chord iteration costs a restamp and a back-substitution.
+                // Holding J only pays while the error, shrinking by theta per iteration, is
+                // projected to meet the tolerance within chordMaxIterations more of them.
+                const double remaining = errorScale * newtonUpdateRatio(solution, lastSolution);
+                refactor = !roundoff && lastUpdateNorm > 0.0 &&
+                           (theta >= 1.0 || !(std::pow(theta, simulationOptions.chordMaxIterations) * remaining <= 1.0));
+            }
+            lastUpdateNorm = (i == 0 && !freshJacobian) ? 0.0 : updateNorm;
+        }
+        if (canConverge && newtonConverged(solution, lastSolution, errorScale)) {
+            converged = true;
+            break;
+        }
+        // With every device bypassed the next system is the one just solved, as long as it
+        // was solved with its own Jacobian.
+        const long limitedBefore = analysisStats.limitedEvaluations;
+        if (updateNonlinearComponentStates(solution) == 0 && freshJacobian) {
+            converged = true;
+            break;
+        }
+        limited = analysisStats.limitedEvaluations != limitedBefore;
+        // A limited junction is linearized away from solution, so b - A x is no residual there
+        // and the next update is a full Newton step.
+        refactor = refactor || limited || !jacobianFactorized;
+        assemble();
+
+        // Likewise the residual is only measured without limiting; back off along the update
+        // while it rises.
+        double residual = std::numeric_limits<double>::infinity();
+        if (!limited) {
+            residual = (A * solution - b_mna).norm();
+            for (int d = 0; d < simulationOptions.newtonMaxDampingSteps && residual > lastResidual; ++d) {
+                solution = lastSolution + 0.5 * (solution - lastSolution);
+                updateNonlinearComponentStates(solution);
+                assemble();
+                residual = (A * solution - b_mna).norm();
+                ++analysisStats.dampedIterations;
             }
-            if (!converged)
-                std::cout << "Warning: Transient analysis did not converge at t = " << t << "s" << std::endl;
+        }
+        lastSolution = solution;
+        lastResidual = residual;
+    }
+    return solution;
+}
+
+// Picks the integration formula for a step of size h from the accepted history: the first
+// point has none and uses backward Euler, and BDF2 waits for two accepted points. The step
+// after a source breakpoint also restarts with backward Euler, which does not ring on the
+// corner the way the trapezoidal rule does.
+void Circuit::beginTimeStep(double h) {
+    IntegrationMethod method = simulationOptions.integrationMethod;
+    const size_t history = transientSolutions.size();
+    if (history == 0 || restartIntegration || (method == IntegrationMethod::BDF2 && history < 2))
+        method = IntegrationMethod::BACKWARD_EULER;
+    double previousStep = 0.0;
+    if (history >= 2) {
+        auto last = transientSolutions.rbegin();
+        previousStep = last->first - std::next(last)->first;
+    }
+
+    IntegrationStep step = IntegrationStep::make(method, h, previousStep);
+    if (step.method == integrationStep.method && step.h == integrationStep.h && step.alpha == integrationStep.alpha &&
+        step.beta1 == integrationStep.beta1 && step.beta2 == integrationStep.beta2)
+        return;
+    integrationStep = step;
+    for (const auto& comp : components)
+        comp->setIntegrationStep(integrationStep);
+}
+
+void Circuit::acceptTimePoint(double t, const Eigen::VectorXd& solution, bool atBreakpoint) {
+    updateComponentStates(solution);
+    transientSolutions[t] = solution;
+    restartIntegration = atBreakpoint;
+    ++analysisStats.acceptedSteps;
+}
+
+// The earliest corner of a source waveform strictly after time (infinity if none).
+double Circuit::nextBreakpoint(double time) const {
+    double next = std::numeric_limits<double>::infinity();
+    for (const auto& comp : components)
+        next = std::min(next, comp->nextBreakpoint(time));
+    return next;
+}
+
+// Variable-step transient. A step that fails to converge or whose truncation error ratio
+// exceeds 1 is rejected and retried with a smaller h; after an accepted step h grows by
+// up to 2x. The error of an order-p method scales with h^(p+1).
+bool Circuit::runAdaptiveTransient(double startTime, double stopTime, double maxTimeStep) {
+    const double minStep = simulationOptions.minTimeStep > 0.0 ? simulationOptions.minTimeStep : maxTimeStep * 1e-9;
+    double h = std::max(minStep, std::min(maxTimeStep, (stopTime - startTime) / 1000));
+
+    // The initial point: a minimal step from the reset states, i.e. uncharged capacitors
+    // and currentless inductors, or from the operating point.
+    bool converged;
+    Eigen::VectorXd solution = solveTimePoint(startTime, minStep, converged);
+    if (solution.size() == 0) {
+        std::cout << "ERROR at t = " << startTime << "s: Simulation stopped." << std::endl;
+        return false;
+    }
+    acceptTimePoint(startTime, solution);
+
+    double t = startTime;
+    while (stopTime - t > 0.5 * minStep) {
+        double step = std::min(h, stopTime - t);
+        // Steps end exactly on source corners.
+        const double breakpoint = nextBreakpoint(t + 0.5 * minStep);
+        const bool atBreakpoint = breakpoint <= t + step;
+        if (atBreakpoint)
+            step = breakpoint - t;
+        solution = solveTimePoint(t + step, step, converged);
+        double ratio = (converged && solution.size() != 0) ? truncationErrorRatio(solution, t + step) : std::numeric_limits<double>::infinity();
+        double exponent = -1.0 / (integrationStep.order() + 1);
+
+        if (ratio > 1.0 && step > minStep) {
+            ++analysisStats.rejectedSteps;
+            h = std::max(minStep, step * std::clamp(0.9 * std::pow(ratio, exponent), 0.125, 0.9));
+            continue;
         }
         if (solution.size() == 0) {
-            std::cout << "ERROR at t = " << t << "s: Simulation stopped." << std::endl;
-            return;
+            std::cout << "ERROR at t = " << t + step << "s: Simulation stopped." << std::endl;
+            return false;
+        }
+        if (!converged)
+            std::cout << "Warning: Transient analysis did not converge at t = " << t + step << "s" << std::endl;
+        else if (ratio > 1.0)
+            std::cout << "Warning: Time step at its minimum at t = " << t + step << "s, truncation error above tolerance." << std::endl;
+
+        t = atBreakpoint ? breakpoint : t + step;
+        acceptTimePoint(t, solution, atBreakpoint);
+        h = std::min(maxTimeStep, step * std::clamp(0.9 * std::pow(ratio, exponent), 0.5, 2.0));
+    }
+    return true;
+}
+
+// Estimated local truncation error of the step to t that produced solution, relative to
+// its tolerance; above 1 the step is rejected. An order-p method errs by C h^(p+1) x^(p+1)
+// (C = 1/2 for backward Euler, 1/12 trapezoidal, 2/9 BDF2); the derivative of each capacitor
+// voltage and inductor current comes from the divided difference over the last p+1
+// accepted points and the new one.
+double Circuit::truncationErrorRatio(const Eigen::VectorXd& solution, double t) const {
+    const int order = integrationStep.order();
+    if (static_cast<int>(transientSolutions.size()) < order + 1)
+        return 0.0;
+
+    // The points of the difference, oldest first.
+    std::vector<double> times(order + 2);
+    std::vector<const Eigen::VectorXd*> points(order + 2);
+    times[order + 1] = t;
+    points[order + 1] = &solution;
+    auto accepted = transientSolutions.rbegin();
+    for (int k = order; k >= 0; --k, ++accepted) {
+        times[k] = accepted->first;
+        points[k] = &accepted->second;
+    }
+
+    double errorConstant = 0.5;
+    if (integrationStep.method == IntegrationMethod::TRAPEZOIDAL)
+        errorConstant = 1.0 / 12.0;
+    else if (integrationStep.method == IntegrationMethod::BDF2)
+        errorConstant = 2.0 / 9.0;
+    const double h = t - times[order];
+    const double scale = errorConstant * std::pow(h, order + 1) * std::tgamma(order + 2.0); // C h^(p+1) (p+1)!
+
+    double worst = 0.0;
+    std::vector<double> differences(order + 2);
+    for (const auto& comp : components) {
+        if (!comp->isReactive())
+            continue;
+        for (int k = 0; k <= order + 1; ++k)
+            differences[k] = comp->integratedQuantity(*points[k]);
+        for (int level = 1; level <= order + 1; ++level)
+            for (int k = order + 1; k >= level; --k)
+                differences[k] = (differences[k] - differences[k - 1]) / (times[k] - times[k - level]);
+
+        double x2 = comp->integratedQuantity(solution);
+        double x1 = comp->integratedQuantity(*points[order]);
+        double error = scale * std::abs(differences[order + 1]);
+        double absTol = (comp->type == Component::Type::INDUCTOR) ? simulationOptions.truncationCurrentAbsTol : simulationOptions.truncationVoltageAbsTol;
+        double tolerance = simulationOptions.truncationRelTol * std::max(std::abs(x2), std::abs(x1)) + absTol;
+        worst = std::max(worst, error / tolerance);
+    }
+    return worst;
+}
+
+// Solves the AC system built by buildMNAMatrix_AC at every omega. Points are handed out
+// to the worker threads one at a time; each worker owns a copy of A_ac and a sparse LU
+// whose symbolic analysis it reuses for all of its points. The unknowns are already in
+// fill-reducing order (see orderUnknowns), so the LU keeps the column order.
+bool Circuit::solveACPoints(const std::vector<double>& omegas, std::vector<Eigen::VectorXcd>& solutions) const {
+    solutions.assign(omegas.size(), Eigen::VectorXcd());
+    if (omegas.empty())
+        return true;
+
+    int threadCount = simulationOptions.acSweepThreads;
+    if (threadCount <= 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<int>(threadCount, static_cast<int>(omegas.size()));
+
+    std::atomic<size_t> nextPoint(0);
+    std::atomic<bool> failed(false);
+    // An exception leaving a thread would call std::terminate; it fails the sweep instead.
+    auto worker = [&]() {
+        try {
+            Eigen::SparseMatrix<std::complex<double>> A = A_ac;
+            Eigen::SparseLU<Eigen::SparseMatrix<std::complex<double>>, Eigen::NaturalOrdering<int>> solver;
+            solver.analyzePattern(A);
+            for (size_t i = nextPoint++; i < omegas.size() && !failed; i = nextPoint++) {
+                setACFrequency(A, omegas[i]);
+                solver.factorize(A);
+                if (solver.info() != Eigen::Success) {
+                    failed = true;
+                    return;
+                }
+                solutions[i] = solver.solve(b_ac);
+            }
+        } catch (...) {
+            failed = true;
         }
-        updateComponentStates(solution, nodeIdToMnaIndex);
-        transientSolutions[t] = solution;
+    };
+
+    std::vector<std::thread> pool;
+    try {
+        for (int t = 1; t < threadCount; ++t)
+            pool.emplace_back(worker);
+    } catch (...) {
+        // The threads already started must be joined before their std::thread objects go.
+        failed = true;
+        for (auto& thread : pool)
+            thread.join();
+        throw;
+    }
+    worker();
+    for (auto& thread : pool)
+        thread.join();
+    return !failed;
+}
+
+// Largest phase change of a node voltage between two neighbouring sweep points, compared
+// against the adaptive sweep tolerance. The magnitude is judged by acCurvature() alone: a
+// straight dB slope over log(omega), like a filter asymptote, needs no extra points.
+bool Circuit::needsACRefinement(const Eigen::VectorXcd& left, const Eigen::VectorXcd& right) const {
+    const double floor = 1e-12;
+    for (const auto& pair : nodeIdToMnaIndex) {
+        std::complex<double> a = left(pair.second), b = right(pair.second);
+        if (std::abs(a) < floor || std::abs(b) < floor)
+            continue;
+        double deltaPhase = std::abs(std::arg(b / a)) * 180.0 / std::numbers::pi;
+        if (deltaPhase > simulationOptions.acAdaptiveMaxDeltaPhase)
+            return true;
     }
-    std::cout << "Transient analysis complete. " << transientSolutions.size() << " time points stored." << std::endl;
+    return false;
 }
 
-void Circuit::runACAnalysis(double startOmega, double stopOmega, int numPoints) {
+// Largest distance (in dB) of the middle point from the straight line through its
+// neighbours on a dB over log(omega) plot.
+double Circuit::acCurvature(double w0, const Eigen::VectorXcd& x0, double w1, const Eigen::VectorXcd& x1, double w2, const Eigen::VectorXcd& x2) const {
+    const double floor = 1e-12;
+    double t = std::log(w1 / w0) / std::log(w2 / w0);
+    double worst = 0.0;
+    for (const auto& pair : nodeIdToMnaIndex) {
+        int k = pair.second;
+        double d0 = 20.0 * std::log10(std::max(std::abs(x0(k)), floor));
+        double d1 = 20.0 * std::log10(std::max(std::abs(x1(k)), floor));
+        double d2 = 20.0 * std::log10(std::max(std::abs(x2(k)), floor));
+        worst = std::max(worst, std::abs(d1 - (d0 + t * (d2 - d0))));
+    }
+    return worst;
+}
+
+// Starts from a logarithmic grid and keeps inserting geometric midpoints into the
+// intervals whose phase turns too much or whose neighbourhood is curved in dB, until the
+// response is resolved or acAdaptiveMaxPoints is reached. Each round is solved in parallel.
+void Circuit::refineACSweep(double startOmega, double stopOmega, int pointsPerDecade) {
+    double factor = std::pow(10.0, 1.0 / pointsPerDecade);
+    int intervals = std::max(1, static_cast<int>(std::ceil(std::log(stopOmega / startOmega) / std::log(factor) - 1e-9)));
+    std::vector<double> omegas;
+    for (int i = 0; i <= intervals; ++i)
+        omegas.push_back(std::min(startOmega * std::pow(factor, i), stopOmega));
+
+    const int maxPoints = std::max(simulationOptions.acAdaptiveMaxPoints, static_cast<int>(omegas.size()));
+    while (!omegas.empty()) {
+        std::vector<Eigen::VectorXcd> solutions;
+        if (!solveACPoints(omegas, solutions))
+            throw std::runtime_error("AC Analysis failed.");
+        for (size_t i = 0; i < omegas.size(); ++i)
+            acSweepSolutions[omegas[i]] = std::move(solutions[i]);
+
+        std::vector<std::pair<double, const Eigen::VectorXcd*>> points;
+        for (const auto& pair : acSweepSolutions)
+            points.emplace_back(pair.first, &pair.second);
+
+        std::vector<bool> split(points.size() - 1, false);
+        for (size_t i = 0; i + 1 < points.size(); ++i)
+            split[i] = needsACRefinement(*points[i].second, *points[i + 1].second);
+        for (size_t i = 1; i + 1 < points.size(); ++i) {
+            double bend = acCurvature(points[i - 1].first, *points[i - 1].second, points[i].first, *points[i].second,
+                                      points[i + 1].first, *points[i + 1].second);
+            if (bend > simulationOptions.acAdaptiveMaxDeltaDB)
+                split[i - 1] = split[i] = true;
+        }
+
+        omegas.clear();
+        for (size_t i = 0; i + 1 < points.size(); ++i) {
+            if (acSweepSolutions.size() + omegas.size() >= static_cast<size_t>(maxPoints))
+                break;
+            double mid = std::sqrt(points[i].first * points[i + 1].first);
+            if (split[i] && mid > points[i].first * (1.0 + 1e-9) && mid < points[i + 1].first)
+                omegas.push_back(mid);
+        }
+    }
+}
+
+void Circuit::runACAnalysis(double startOmega, double stopOmega, int numPoints, ACSweepType sweepType) {
     if (groundNodeIds.empty())
         throw std::runtime_error("No ground node detected.");
 
@@ -702,23 +1663,105 @@ void Circuit::runACAnalysis(double startOmega, double stopOmega, int numPoints)
     if (!acSourceFound)
         throw std::runtime_error("AC Sweep failed. No AC source found.");
 
+    // At omega = 0 the complex system is G alone, singular wherever a node hangs on capacitors.
+    if (startOmega <= 0)
+        throw std::runtime_error("AC Sweep needs a start frequency greater than zero.");
+    if (numPoints < 1)
+        throw std::runtime_error("AC Sweep needs at least one point.");
+    if (!circuitCompiled)
+        compileCircuit();
+    if (!topologyReport.ok())
+        throw std::runtime_error("AC Sweep failed. " + topologyReport.errors.front());
+    if (hasNonlinearComponents && !topologyReport.ok(true))
+        throw std::runtime_error("AC Sweep failed. No DC operating point: " + topologyReport.dcErrors.front());
+    // Nonlinear devices enter the small-signal circuit linearized at the DC operating point,
+    // not at whatever state the last analysis left them in.
+    if (hasNonlinearComponents && !findOperatingPoint(0.0))
+        throw std::runtime_error("AC Sweep failed. No DC operating point found.");
+
     acSweepSolutions.clear();
-    double omegaStep = (numPoints > 1) ? (stopOmega - startOmega) / (numPoints - 1) : 0;
+    buildMNAMatrix_AC();
+    if (A_ac.rows() == 0)
+        throw std::runtime_error("AC Analysis failed.");
 
-    for (double w = omegaStep; w <= stopOmega; w += omegaStep) {
-        buildMNAMatrix_AC(w);
-        Eigen::VectorXd solution = solveMNASystem();
-        if (solution.size() > 0)
-            acSweepSolutions[w] = solution;
-        else
-            throw std::runtime_error("AC Analysis failed.");
+    if (sweepType == ACSweepType::ADAPTIVE) {
+        refineACSweep(startOmega, stopOmega, numPoints);
+        std::cout << "AC Sweep complete. " << acSweepSolutions.size() << " frequency points stored." << std::endl;
+        return;
     }
+
+    std::vector<double> omegas;
+    if (sweepType == ACSweepType::LINEAR) {
+        double omegaStep = (numPoints > 1) ? (stopOmega - startOmega) / (numPoints - 1) : 0;
+        for (int i = 0; i < numPoints; ++i)
+            omegas.push_back(startOmega + i * omegaStep);
+    }
+    else {
+        double ratio = (sweepType == ACSweepType::DECADE) ? 10.0 : 2.0;
+        double factor = std::pow(ratio, 1.0 / numPoints);
+        // Index-based so that rounding never drops the stop frequency.
+        int intervals = static_cast<int>(std::ceil(std::log(stopOmega / startOmega) / std::log(factor) - 1e-9));
+        for (int i = 0; i <= intervals; ++i)
+            omegas.push_back(std::min(startOmega * std::pow(factor, i), stopOmega));
+    }
+
+    std::vector<Eigen::VectorXcd> solutions;
+    if (!solveACPoints(omegas, solutions))
+        throw std::runtime_error("AC Analysis failed.");
+
+    for (size_t i = 0; i < omegas.size(); ++i)
+        acSweepSolutions[omegas[i]] = std::move(solutions[i]);
     std::cout << "AC Sweep complete. " << acSweepSolutions.size() << " frequency points stored." << std::endl;
 }
 // -------------------------------- Analysis Methods --------------------------------
 
 
 // -------------------------------- Output Results --------------------------------
+// Entry of an MNA solution vector; index -1 (ground) reads as zero.
+static double solutionValue(const Eigen::VectorXd& solution, int index) {
+    return (index == -1) ? 0.0 : solution(index);
+}
+
+// V(node) and I(component) at the operating point. Capacitors carry no current at DC.
+std::map<std::string, double> Circuit::getOperatingPointResults(const std::vector<std::string>& variablesToPrint) const {
+    std::map<std::string, double> results;
+    if (operatingPoint.size() == 0) {
+        std::cout << "No operating point found. Run the operating point analysis first." << std::endl;
+        return {};
+    }
+
+    for (const auto& var : variablesToPrint) {
+        if (var.length() < 4)
+            continue;
+        std::string type = var.substr(0, 1);
+        std::string name = var.substr(2, var.length() - 3);
+
+        if (type == "V") {
+            if (!hasNode(name)) {
+                std::cout << "Node " << name << " not found." << std::endl;
+                continue;
+            }
+            results[var] = solutionValue(operatingPoint, mnaIndexOf(nodeNameToId.at(name)));
+        }
+        else if (type == "I") {
+            if (componentCurrentIndices.count(name)) {
+                results[var] = operatingPoint(componentCurrentIndices.at(name));
+                continue;
+            }
+            auto comp = getComponent(name);
+            if (!comp)
+                std::cout << "Component " << name << " not found." << std::endl;
+            else if (dynamic_cast<Resistor*>(comp.get()))
+                results[var] = (solutionValue(operatingPoint, mnaIndexOf(comp->node1)) - solutionValue(operatingPoint, mnaIndexOf(comp->node2))) / comp->value;
+            else if (dynamic_cast<Capacitor*>(comp.get()))
+                results[var] = 0.0;
+            else
+                std::cout << "Warning: Current for component type of '" << name << "' cannot be calculated." << std::endl;
+        }
+    }
+    return results;
+}
+
 std::map<std::string, std::map<double, double>> Circuit::getTransientResults(const std::vector<std::string>& variablesToPrint) const {
     std::map<std::string, std::map<double, double>> results;
 
@@ -727,14 +1770,6 @@ std::map<std::string, std::map<double, double>> Circuit::getTransientResults(con
         return {};
     }
 
-    std::map<int, int> nodeIdToMnaIndex;
-    int currentMnaIndex = 0;
-    for (int i = 0; i < nextNodeId; ++i) {
-        if (idToNodeName.count(i) && !isGround(i)) {
-            nodeIdToMnaIndex[i] = currentMnaIndex++;
-        }
-    }
-
     struct PrintJob {
         std::string header;
         enum class Type { VOLTAGE, MNA_CURRENT, RESISTOR_CURRENT, CAPACITOR_CURRENT } type;
@@ -755,7 +1790,7 @@ std::map<std::string, std::map<double, double>> Circuit::getTransientResults(con
                 return {};
             }
             int nodeID = nodeNameToId.at(name);
-            int solutionIndex = isGround(nodeID) ? -1 : nodeIdToMnaIndex.at(nodeID);
+            int solutionIndex = mnaIndexOf(nodeID);
             printJobs.push_back({var, PrintJob::Type::VOLTAGE, solutionIndex, nullptr});
         }
         else if (type == "I") {
@@ -798,8 +1833,8 @@ std::map<std::string, std::map<double, double>> Circuit::getTransientResults(con
             else {
                 int node1 = job.component_ptr->node1;
                 int node2 = job.component_ptr->node2;
-                double v1 = isGround(node1) ? 0.0 : solution(nodeIdToMnaIndex.at(node1));
-                double v2 = isGround(node2) ? 0.0 : solution(nodeIdToMnaIndex.at(node2));
+                double v1 = solutionValue(solution, mnaIndexOf(node1));
+                double v2 = solutionValue(solution, mnaIndexOf(node2));
 
                 if (job.type == PrintJob::Type::RESISTOR_CURRENT)
                     result = (v1 - v2) / job.component_ptr->value;
@@ -808,8 +1843,8 @@ std::map<std::string, std::map<double, double>> Circuit::getTransientResults(con
                         result = 0.0;
                     else {
                         const Eigen::VectorXd& prevSolution = itPrev->second;
-                        double v1_prev = isGround(node1) ? 0.0 : prevSolution(nodeIdToMnaIndex.at(node1));
-                        double v2_prev = isGround(node2) ? 0.0 : prevSolution(nodeIdToMnaIndex.at(node2));
+                        double v1_prev = solutionValue(prevSolution, mnaIndexOf(node1));
+                        double v2_prev = solutionValue(prevSolution, mnaIndexOf(node2));
                         double vCap_prev = v1_prev - v2_prev;
                         double vCap_now = v1 - v2;
                         double h = t - itPrev->first;
@@ -825,59 +1860,88 @@ std::map<std::string, std::map<double, double>> Circuit::getTransientResults(con
     return results;
 }
 
+static std::complex<double> solutionValue(const Eigen::VectorXcd& solution, int index) {
+    return (index == -1) ? std::complex<double>(0.0, 0.0) : solution(index);
+}
+
+// Variables follow the SPICE convention: V(n)/VM(n) magnitude, VP(n) phase in degrees,
+// VDB(n) magnitude in dB, VR(n)/VI(n) real and imaginary parts; likewise for I(...).
 std::map<std::string, std::map<double, double>> Circuit::getACSweepResults(const std::vector<std::string>& variables) const {
     std::map<std::string, std::map<double, double>> results;
 
     if (acSweepSolutions.empty())
         throw std::runtime_error("No AC analysis results found. Run .AC analysis first.");
 
-    std::map<int, int> nodeIdToMnaIndex;
-    int currentMnaIndex = 0;
-    for (int i = 0; i < nextNodeId; ++i) {
-        if (idToNodeName.count(i) && !isGround(i)) {
-            nodeIdToMnaIndex[i] = currentMnaIndex++;
-        }
-    }
+    enum class Part { MAGNITUDE, PHASE, DB, REAL, IMAG };
+    struct PrintJob {
+        std::string header;
+        char varType;
+        std::string varName;
+        Part part;
+    };
+    std::vector<PrintJob> jobs;
+    for (const auto& variable : variables) {
+        results[variable];
+        size_t open = variable.find('(');
+        if (open == std::string::npos || open == 0 || variable.back() != ')')
+            continue;
 
-    for (const auto& var : variables)
-        results[var];
+        std::string prefix = variable.substr(0, open);
+        for (auto& ch : prefix)
+            ch = std::toupper(static_cast<unsigned char>(ch));
+        std::string suffix = prefix.substr(1);
+        Part part;
+        if (suffix.empty() || suffix == "M") part = Part::MAGNITUDE;
+        else if (suffix == "P") part = Part::PHASE;
+        else if (suffix == "DB") part = Part::DB;
+        else if (suffix == "R") part = Part::REAL;
+        else if (suffix == "I") part = Part::IMAG;
+        else continue;
+
+        if (prefix[0] != 'V' && prefix[0] != 'I')
+            continue;
+        jobs.push_back({variable, prefix[0], variable.substr(open + 1, variable.length() - open - 2), part});
+    }
 
     for (const auto& pair : acSweepSolutions) {
         double omega = pair.first;
-        const Eigen::VectorXd& solution = pair.second;
-        double resultValue = 0.0;
+        const Eigen::VectorXcd& solution = pair.second;
 
-        for (const auto& variable : variables) {
-            if (variable.length() < 4)
-                continue;
-
-            char varType = variable.front();
-            std::string varName = variable.substr(2, variable.length() - 3);
-            double resultValue = 0.0;
+        for (const auto& job : jobs) {
+            std::complex<double> phasor(0.0, 0.0);
 
-            if (varType == 'V') {
-                int nodeId = getNodeId(varName);
+            if (job.varType == 'V') {
+                int nodeId = getNodeId(job.varName);
                 if (nodeId != -1)
-                    resultValue = isGround(nodeId) ? 0.0 : solution(nodeIdToMnaIndex.at(nodeId));
+                    phasor = solutionValue(solution, mnaIndexOf(nodeId));
             }
-            else if (varType == 'I') {
-                auto comp = getComponent(varName);
+            else {
+                auto comp = getComponent(job.varName);
                 if (!comp) continue;
 
-                if (comp->needsCurrentUnknown() && componentCurrentIndices.count(varName))
-                    resultValue = solution(componentCurrentIndices.at(varName));
+                if (comp->needsCurrentUnknown() && componentCurrentIndices.count(job.varName))
+                    phasor = solution(componentCurrentIndices.at(job.varName));
                 else {
-                    double v1 = isGround(comp->node1) ? 0.0 : solution(nodeIdToMnaIndex.at(comp->node1));
-                    double v2 = isGround(comp->node2) ? 0.0 : solution(nodeIdToMnaIndex.at(comp->node2));
-                    double voltage_diff = v1 - v2;
+                    std::complex<double> v1 = solutionValue(solution, mnaIndexOf(comp->node1));
+                    std::complex<double> v2 = solutionValue(solution, mnaIndexOf(comp->node2));
+                    std::complex<double> voltage_diff = v1 - v2;
 
                     if (auto* resistor = dynamic_cast<Resistor*>(comp.get()))
-                        resultValue = voltage_diff / resistor->value;
+                        phasor = voltage_diff / resistor->value;
                     else if (auto* capacitor = dynamic_cast<Capacitor*>(comp.get()))
-                        resultValue = voltage_diff * omega * capacitor->value;
+                        phasor = voltage_diff * std::complex<double>(0.0, omega * capacitor->value);
                 }
             }
-            results.at(variable)[omega] = resultValue;
+
+            double resultValue = 0.0;
+            switch (job.part) {
+            case Part::MAGNITUDE: resultValue = std::abs(phasor); break;
+            case Part::PHASE: resultValue = std::arg(phasor) * 180.0 / std::numbers::pi; break;
+            case Part::DB: resultValue = 20.0 * std::log10(std::max(std::abs(phasor), 1e-300)); break;
+            case Part::REAL: resultValue = phasor.real(); break;
+            case Part::IMAG: resultValue = phasor.imag(); break;
+            }
+            results.at(job.header)[omega] = resultValue;
         }
     }
 
@@ -1043,4 +2107,40 @@ QDataStream& operator>>(QDataStream& in, SubcircuitDefinition& def) {
     def.port1NodeName = port1.toStdString();
     def.port2NodeName = port2.toStdString();
     return in;
+}
+
+static void writeNames(QDataStream& out, const std::vector<std::string>& names) {
+    out << (quint32)names.size();
+    for (const auto& name : names) { out << QString::fromStdString(name); }
+}
+static void readNames(QDataStream& in, std::vector<std::string>& names) {
+    quint32 size;
+    in >> size;
+    names.clear();
+    names.reserve(size);
+    for (quint32 i = 0; i < size; ++i) {
+        QString name;
+        in >> name;
+        names.push_back(name.toStdString());
+    }
+}
+
+QDataStream& operator<<(QDataStream& out, const SubcircuitInstance& instance) {
+    out << QString::fromStdString(instance.name) << QString::fromStdString(instance.definition);
+    writeNames(out, instance.internalNodeNames);
+    writeNames(out, instance.componentNames);
+    out << QString::fromStdString(instance.port1NodeName) << QString::fromStdString(instance.port2NodeName);
+    return out;
+}
+QDataStream& operator>>(QDataStream& in, SubcircuitInstance& instance) {
+    QString name, definition, port1, port2;
+    in >> name >> definition;
+    instance.name = name.toStdString();
+    instance.definition = definition.toStdString();
+    readNames(in, instance.internalNodeNames);
+    readNames(in, instance.componentNames);
+    in >> port1 >> port2;
+    instance.port1NodeName = port1.toStdString();
+    instance.port2NodeName = port2.toStdString();
+    return in;
 }
\ No newline at end of file
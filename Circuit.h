@@ -6,6 +6,7 @@
 #include <QMouseEvent>
 #include <QString>
 #include <fstream>
+#include <functional>
 #include <filesystem>
 #include <set>
 #include <QCoreApplication>
@@ -15,6 +16,10 @@
 #include <QDataStream>
 #include "component.h"
 #include "ComponentFactory.h"
+#include "MNASolver.h"
+#include "StampEngine.h"
+#include "SchurComplementSolver.h"
+#include "TopologyChecker.h"
 
 struct ComponentGraphicalInfo {
     QPoint startPoint;
@@ -46,6 +51,104 @@ struct SubcircuitDefinition {
 
 };
 
+// One unrolled subcircuit: its private nodes and components, in definition order.
+struct SubcircuitInstance {
+    std::string name;
+    std::string definition;
+    std::vector<std::string> internalNodeNames;
+    std::vector<std::string> componentNames;
+    std::string port1NodeName;
+    std::string port2NodeName;
+};
+
+// LINEAR spaces numPoints points evenly; DECADE/OCTAVE place numPoints points per
+// decade/octave; ADAPTIVE starts from a per-decade grid and refines where the response changes fast.
+enum class ACSweepType { LINEAR, DECADE, OCTAVE, ADAPTIVE };
+
+struct SimulationOptions {
+    // Linear transient runs with a fixed step have a constant left-hand side, so it is
+    // factored once and every later step only re-stamps the RHS and back-substitutes.
+    bool reuseLinearFactorization = true;
+    // Transient linear solver: sparse LU, ILUT-preconditioned BiCGSTAB for circuits too
+    // large to factor (warm-started from the previous time point), or a single-precision LU
+    // refined to double accuracy for large well-conditioned networks.
+    MNASolver::Backend linearSolver = MNASolver::Backend::SPARSE_LU;
+    IterativeSolverSettings iterativeSettings;
+    // Split the transient matrix into its block triangular form and factor each block alone.
+    bool blockTriangularForm = true;
+    // Newton iterations that only change a few columns (diode conductances) reuse the last
+    // factorization with a low-rank correction instead of refactoring.
+    bool lowRankUpdates = false;
+    int maxUpdateRank = 8;
+    // Companion model of capacitors and inductors. Trapezoidal and BDF2 are second order;
+    // the first step of a run, which has no history, always uses backward Euler.
+    IntegrationMethod integrationMethod = IntegrationMethod::BACKWARD_EULER;
+    // Adaptive transient step: h varies between minTimeStep (0: 1e-9 of the maximum step) and
+    // the maximum step of the analysis, keeping the local truncation error of every capacitor
+    // voltage and inductor current below truncationRelTol * |x| plus the absolute tolerance.
+    // Steps that miss it are rejected and retried with a smaller h.
+    bool adaptiveTimeStep = false;
+    double minTimeStep = 0.0;
+    double truncationRelTol = 1e-3;
+    double truncationVoltageAbsTol = 1e-6; // volts
+    double truncationCurrentAbsTol = 1e-9; // amperes
+    // Device bypass: a nonlinear device whose terminal voltage moved by less than
+    // bypassVoltageTolerance since its last evaluation keeps its previous companion model.
+    bool deviceBypass = true;
+    double bypassVoltageTolerance = 1e-7; // volts
+    // Newton-Raphson: an iterate has converged once no junction voltage was limited and every
+    // unknown moved by less than newtonRelTol * |x| plus newtonVoltageAbsTol (node voltages)
+    // or newtonCurrentAbsTol (branch currents). An update that raises the residual of the
+    // circuit equations is halved, at most newtonMaxDampingSteps times.
+    int newtonMaxIterations = 100;
+    double newtonRelTol = 1e-3;
+    double newtonVoltageAbsTol = 1e-6; // volts
+    double newtonCurrentAbsTol = 1e-12; // amperes
+    int newtonMaxDampingSteps = 4;
+    // Predictor: Newton starts each time point from the polynomial through the last
+    // newtonPredictorOrder + 1 accepted points instead of the last point's linearization
+    // (0 disables it). It is skipped right after a source breakpoint.
+    int newtonPredictorOrder = 2;
+    // Modified (chord) Newton: iterations keep the last factorized Jacobian, carried across
+    // time points, and only re-stamp the residual. The Jacobian is refactored once the rate
+    // at which the updates shrink projects more than chordMaxIterations further iterations.
+    bool chordNewton = false;
+    int chordMaxIterations = 3;
+    // DC operating point: Newton on the circuit with capacitors open and inductors shorted,
+    // every node shunted to ground by operatingPointGmin. Circuits plain Newton fails on are
+    // retried with gmin stepping (shunts lowered from 1e-2 S) and then source stepping (all
+    // independent sources ramped up from zero).
+    double operatingPointGmin = 1e-12; // siemens
+    bool gminStepping = true;
+    bool sourceStepping = true;
+    // Start the transient from the operating point at its start time instead of from
+    // uncharged capacitors and currentless inductors.
+    bool transientFromOperatingPoint = false;
+    // Condense every subcircuit instance onto its ports (Schur complement) in transient runs.
+    bool condenseSubcircuits = false;
+    // Worker threads for the AC sweep; 0 uses every hardware thread, 1 solves serially.
+    int acSweepThreads = 0;
+    // Adaptive AC sweep: an interval is split while a node voltage bends away from a straight
+    // line in dB over log omega by more than acAdaptiveMaxDeltaDB, or its phase changes by
+    // more than acAdaptiveMaxDeltaPhase across the interval.
+    double acAdaptiveMaxDeltaDB = 0.5;
+    double acAdaptiveMaxDeltaPhase = 5.0; // degrees
+    int acAdaptiveMaxPoints = 2000;
+};
+
+// Counters of the last transient or operating point run.
+struct AnalysisStats {
+    long acceptedSteps = 0;
+    long rejectedSteps = 0;           // adaptive steps retried with a smaller h
+    long newtonIterations = 0;
+    long deviceEvaluations = 0;     // nonlinear device linearizations actually computed
+    long bypassedEvaluations = 0;   // linearizations skipped by device bypass
+    long limitedEvaluations = 0;    // linearizations whose junction voltage step was limited
+    long dampedIterations = 0;      // Newton updates shortened because the residual rose
+    long jacobianFactorizations = 0; // factorizations of the Newton matrix
+    long homotopyStages = 0;        // gmin or source stepping stages of the operating point
+};
+
 double parseSpiceValue(const std::string& valueStr);
 
 class Circuit {
@@ -86,23 +189,70 @@ public:
     void processLabelConnections();
 
     // --- Analysis ---
+    void setSimulationOptions(const SimulationOptions& options);
+    const SimulationOptions& getSimulationOptions() const;
+    const AnalysisStats& getAnalysisStats() const;
     void runTransientAnalysis(double startTime, double stopTime, double stepTime);
+    // The DC solution at time, also left as the linearization point of the nonlinear
+    // devices (so a following AC sweep is the small-signal response around it).
+    bool runOperatingPointAnalysis(double time = 0.0);
+    std::map<std::string, double> getOperatingPointResults(const std::vector<std::string>&) const;
     std::map<std::string, std::map<double, double>> getTransientResults(const std::vector<std::string>&) const;
-    void runACAnalysis(double startOmega, double stopOmega, int numPoints);
+    void runACAnalysis(double startOmega, double stopOmega, int numPoints, ACSweepType sweepType = ACSweepType::LINEAR);
     std::map<std::string, std::map<double, double>> getACSweepResults(const std::vector<std::string>&) const;
+    // Solves the transient MNA matrix at (time, h) for every column of rhs against a single
+    // factorization (superposition, transfer functions, adjoint sensitivities). Capacitors and
+    // inductors use the companion model of simulationOptions.integrationMethod at a constant
+    // step h (h = 0: open and short, as at DC); nonlinear devices keep their present
+    // linearization. Rows follow getUnknownIndex(); an empty result means the system could
+    // not be solved.
+    Eigen::MatrixXd solveMNAColumns(const Eigen::MatrixXd& rhs, double time, double h);
+    int getUnknownIndex(const std::string& unknown); // "V(node)" or "I(component)"; -1 if absent
 
     std::map<std::string, SubcircuitDefinition> subcircuitDefinitions;
+    std::vector<SubcircuitInstance> subcircuitInstances;
 
     void saveToFile(const QString& filePath);
     void loadFromFile(const QString& filePath);
 
 private:
-    void buildMNAMatrix(double, double);
-    void buildMNAMatrix_AC(double omega);
-    Eigen::VectorXd solveMNASystem();
-    void updateComponentStates(const Eigen::VectorXd&, const std::map<int, int>&);
-    void updateNonlinearComponentStates(const Eigen::VectorXd&, const std::map<int, int>&);
+    void compileCircuit();
+    void orderUnknowns();
+    void checkTopology();
+    std::vector<SchurComplementSolver::Instance> compileSubcircuitInstances() const;
+    void pruneSubcircuitInstances();
+    int mnaIndexOf(int nodeId) const;
+    bool buildMNAMatrix(double, double);
+    void buildMNAMatrix_AC();
+    void setACFrequency(Eigen::SparseMatrix<std::complex<double>>& A, double omega) const;
+    bool solveACPoints(const std::vector<double>& omegas, std::vector<Eigen::VectorXcd>& solutions) const;
+    void refineACSweep(double startOmega, double stopOmega, int pointsPerDecade);
+    bool needsACRefinement(const Eigen::VectorXcd& left, const Eigen::VectorXcd& right) const;
+    double acCurvature(double w0, const Eigen::VectorXcd& x0, double w1, const Eigen::VectorXcd& x1, double w2, const Eigen::VectorXcd& x2) const;
+    Eigen::VectorXd solveMNASystem(const Eigen::SparseMatrix<double>& A, bool reuseFactorization = false, const Eigen::VectorXd& initialGuess = Eigen::VectorXd());
+    Eigen::VectorXd solveWithFactorization(const Eigen::VectorXd& rhs);
+    bool factorizeMNASystem(const Eigen::SparseMatrix<double>& A, bool reuseFactorization);
+    bool condensingSubcircuits() const;
+    void applySolverOptions();
+    void beginTimeStep(double h);
+    Eigen::VectorXd solveTimePoint(double t, double h, bool& converged);
+    Eigen::VectorXd iterateNewton(const std::function<void()>& assemble, const Eigen::SparseMatrix<double>& A, bool chord,
+                                  double stepScale, bool refactor, const Eigen::VectorXd& start, bool limited, bool& converged);
+    void acceptTimePoint(double t, const Eigen::VectorXd& solution, bool atBreakpoint = false);
+    double nextBreakpoint(double time) const;
+    bool runAdaptiveTransient(double startTime, double stopTime, double maxTimeStep);
+    double truncationErrorRatio(const Eigen::VectorXd& solution, double t) const;
+    void updateComponentStates(const Eigen::VectorXd&);
+    int updateNonlinearComponentStates(const Eigen::VectorXd&);
+    bool newtonConverged(const Eigen::VectorXd& solution, const Eigen::VectorXd& lastSolution, double errorScale = 1.0) const;
+    double newtonUpdateRatio(const Eigen::VectorXd& solution, const Eigen::VectorXd& lastSolution) const;
+    Eigen::VectorXd predictSolution(double t) const;
+    void setNewtonTolerances();
+    bool findOperatingPoint(double time);
+    Eigen::VectorXd solveOperatingPointStage(double time, double gmin, double sourceScale, bool& converged);
+    Eigen::VectorXd stepOperatingPoint(double time, bool rampSources, bool& converged);
     void mergeNodes(int sourceNodeI, int destNodeId);
+    void invalidateTopology();
     bool isGround(int nodeId) const;
     void makeComponentFromLine(const std::string& netListLine);
     std::vector<std::string> generateNetlistFromComponents() const;
@@ -122,14 +272,39 @@ private:
     std::vector<LabelInfo> labels;
     std::map<std::string, std::set<int>> labelToNodes;
 
+    // Compiled topology (see compileCircuit)
+    bool circuitCompiled;
+    TopologyChecker::Report topologyReport; // findings of checkTopology() for this topology
+    std::map<int, int> nodeIdToMnaIndex;
+    int mnaSize;
+
     // MNA Matrix data
-    Eigen::MatrixXd A_mna;
+    StampEngine stampEngine; // transient matrix stamps, grouped by component type
+    bool matrixStampsValid; // A_mna carries the stamp engine's pattern
+    Eigen::SparseMatrix<double> A_mna;
     Eigen::VectorXd b_mna;
+    MNASolver mnaSolver; // keeps the symbolic factorization until the topology changes
+    SchurComplementSolver schurSolver; // used instead of mnaSolver when condenseSubcircuits is set
     int numCurrentUnknowns;
     std::map<std::string, int> componentCurrentIndices; // component name -> MNA component index
     std::map<double, Eigen::VectorXd> transientSolutions;
-    std::map<double, Eigen::VectorXd> acSweepSolutions;
+    std::map<double, Eigen::VectorXcd> acSweepSolutions;
+
+    // AC system: A_ac holds G + j*omega*C on a pattern fixed for the whole sweep
+    Eigen::SparseMatrix<std::complex<double>> A_ac;
+    std::vector<std::complex<double>> acStampValues; // per nonzero: real part G, imaginary part C
+    Eigen::VectorXcd b_ac;
     bool hasNonlinearComponents;
+    SimulationOptions simulationOptions;
+    AnalysisStats analysisStats;
+    IntegrationStep integrationStep; // formula of the transient step being solved
+    bool restartIntegration = false; // the last accepted point is a source breakpoint
+    Eigen::VectorXd newtonAbsTol; // per MNA unknown: volts for nodes, amperes for branch currents
+    bool jacobianFactorized = false; // the solver holds a usable Newton matrix of this run (chord Newton)
+    double jacobianStepScale = 0.0; // alpha / h of the reactive companion models in that matrix
+    Eigen::VectorXd operatingPoint; // result of the last operating point analysis
+    Eigen::SparseMatrix<double> nodeShunts; // DC system: unit conductance from every node to ground
+    Eigen::VectorXd sourceRHS; // DC system: the independent sources' part of b_mna
 
     // State and file management
     QString currentProjectName;
@@ -160,6 +335,8 @@ QDataStream& operator<<(QDataStream& out, const GroundInfo& info);
 QDataStream& operator>>(QDataStream& in, GroundInfo& info);
 QDataStream& operator<<(QDataStream& out, const SubcircuitDefinition& def);
 QDataStream& operator>>(QDataStream& in, SubcircuitDefinition& def);
+QDataStream& operator<<(QDataStream& out, const SubcircuitInstance& instance);
+QDataStream& operator>>(QDataStream& in, SubcircuitInstance& instance);
 
 
 #endif // CIRCUIT_H
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include <QString>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 
 #include "component.h"
 
@@ -7,413 +10,433 @@ Resistor::Resistor(const std::string& n, int n1, int n2, double v)
     : Component(Type::RESISTOR, n, n1, n2, v) {}
 
 Capacitor::Capacitor(const std::string& n, int n1, int n2, double v)
-    : Component(Type::CAPACITOR, n, n1, n2, v), V_prev(0.0) {}
+    : Component(Type::CAPACITOR, n, n1, n2, v), V_prev(0.0), V_prev2(0.0), I_prev(0.0) {}
 
 Inductor::Inductor(const std::string& n, int n1, int n2, double v)
-    : Component(Type::INDUCTOR, n, n1, n2, v), I_prev(0.0) {}
+    : Component(Type::INDUCTOR, n, n1, n2, v), I_prev(0.0), I_prev2(0.0), V_prev(0.0) {}
 
 Diode::Diode(const std::string& n, int n1, int n2, double is, double et, double vt)
-    : Component(Type::DIODE, n, n1, n2, 0.0), Is(is), eta(et), Vt(vt), V_prev(0.7) {}
+    : Component(Type::DIODE, n, n1, n2, 0.0), Is(is), eta(et), Vt(vt), V_prev(0.7), limited(false) {
+    updateLinearization();
+}
 
 VoltageSource::VoltageSource(const std::string& n, int n1, int n2, SourceType st, double p1, double p2, double p3)
     : Component(Type::VOLTAGE_SOURCE, n, n1, n2, 0.0), sourceType(st), param1(p1), param2(p2), param3(p3) {}
 
+VoltageSource::VoltageSource(const std::string& n, int n1, int n2, SourceType st, const std::vector<double>& waveformParams)
+    : Component(Type::VOLTAGE_SOURCE, n, n1, n2, 0.0), sourceType(st), param1(0), param2(0), param3(0),
+      waveform(st == SourceType::Pulse ? SourceWaveform::pulse(waveformParams) : SourceWaveform::piecewiseLinear(waveformParams)) {}
+
 ACVoltageSource::ACVoltageSource(const std::string& name, int node1, int node2)
     : Component(Type::AC_VOLTAGE_SOURCE, name, node1, node2, 1.0) {}
 
 CurrentSource::CurrentSource(const std::string& n, int n1, int n2, SourceType st, double p1, double p2, double p3)
     : Component(Type::CURRENT_SOURCE, n, n1, n2, 0.0), sourceType(st), param1(p1), param2(p2), param3(p3) {}
 
+CurrentSource::CurrentSource(const std::string& n, int n1, int n2, SourceType st, const std::vector<double>& waveformParams)
+    : Component(Type::CURRENT_SOURCE, n, n1, n2, 0.0), sourceType(st), param1(0), param2(0), param3(0),
+      waveform(st == SourceType::Pulse ? SourceWaveform::pulse(waveformParams) : SourceWaveform::piecewiseLinear(waveformParams)) {}
+
 VCVS::VCVS(const std::string& n, int n1, int n2, int c_n1, int c_n2, double g)
-    : Component(Type::VCVS, n, n1, n2, 0.0), ctrlNode1(c_n1), ctrlNode2(c_n2), gain(g) {}
+    : Component(Type::VCVS, n, n1, n2, 0.0), ctrlNode1(c_n1), ctrlNode2(c_n2), ctrlIndex1(-1), ctrlIndex2(-1), gain(g) {}
 
 VCCS::VCCS(const std::string& n, int n1, int n2, int c_n1, int c_n2, double g)
-    : Component(Type::VCCS, n, n1, n2, 0.0), ctrlNode1(c_n1), ctrlNode2(c_n2), gain(g) {}
+    : Component(Type::VCCS, n, n1, n2, 0.0), ctrlNode1(c_n1), ctrlNode2(c_n2), ctrlIndex1(-1), ctrlIndex2(-1), gain(g) {}
 
 CCVS::CCVS(const std::string& n, int n1, int n2, const std::string &c_name, double g)
-    : Component(Type::CCVS, n, n1, n2, 0.0), ctrlCompName(std::move(c_name)), gain(g) {}
+    : Component(Type::CCVS, n, n1, n2, 0.0), ctrlCompName(std::move(c_name)), gain(g), sourceIndex(-1) {}
 
 CCCS::CCCS(const std::string& n, int n1, int n2, const std::string &c_name, double g)
-    : Component(Type::CCCS, n, n1, n2, 0.0), ctrlCompName(std::move(c_name)), gain(g) {}
+    : Component(Type::CCCS, n, n1, n2, 0.0), ctrlCompName(std::move(c_name)), gain(g), sourceIndex(-1) {}
 // -------------------------------- Constructor impementation --------------------------------
 
 
-// -------------------------------- Update state implementation --------------------------------
-void Capacitor::updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) {
-    double v1 = 0.0, v2 = 0.0;
+// -------------------------------- Compile implementation --------------------------------
+void Component::compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) {
+    auto n1 = nodeIdToMnaIndex.find(node1);
+    auto n2 = nodeIdToMnaIndex.find(node2);
+    n1Index = (n1 == nodeIdToMnaIndex.end()) ? -1 : n1->second;
+    n2Index = (n2 == nodeIdToMnaIndex.end()) ? -1 : n2->second;
+    branchIndex = idx;
+}
+
+void VCVS::compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) {
+    Component::compile(ci, nodeIdToMnaIndex, idx);
+    auto c1 = nodeIdToMnaIndex.find(ctrlNode1);
+    auto c2 = nodeIdToMnaIndex.find(ctrlNode2);
+    ctrlIndex1 = (c1 == nodeIdToMnaIndex.end()) ? -1 : c1->second;
+    ctrlIndex2 = (c2 == nodeIdToMnaIndex.end()) ? -1 : c2->second;
+}
+
+void VCCS::compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) {
+    Component::compile(ci, nodeIdToMnaIndex, idx);
+    auto c1 = nodeIdToMnaIndex.find(ctrlNode1);
+    auto c2 = nodeIdToMnaIndex.find(ctrlNode2);
+    ctrlIndex1 = (c1 == nodeIdToMnaIndex.end()) ? -1 : c1->second;
+    ctrlIndex2 = (c2 == nodeIdToMnaIndex.end()) ? -1 : c2->second;
+}
+
+void CCVS::compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) {
+    Component::compile(ci, nodeIdToMnaIndex, idx);
+    auto it = ci.find(ctrlCompName);
+    sourceIndex = (it == ci.end()) ? -1 : it->second;
+    if (sourceIndex == -1)
+        std::cerr << "ERROR: Controlling component '" << ctrlCompName << "' for CCVS '" << name << "' not found or has no current." << std::endl;
+}
+
+void CCCS::compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) {
+    Component::compile(ci, nodeIdToMnaIndex, idx);
+    auto it = ci.find(ctrlCompName);
+    sourceIndex = (it == ci.end()) ? -1 : it->second;
+    if (sourceIndex == -1)
+        std::cerr << "ERROR: Controlling component '" << ctrlCompName << "' for CCCS '" << name << "' not found or has no current." << std::endl;
+}
+// -------------------------------- Compile implementation --------------------------------
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
 
-    if (!n1_is_ground) {
-        v1 = solution(nodeIdToMnaIndex.at(node1));
+// -------------------------------- Integration formulas --------------------------------
+// Trapezoidal: x_n+1 = x_n + h/2 (x'_n+1 + x'_n).
+// BDF2 with step ratio w = h / previousStep: x'_n+1 = ((1+2w)/(1+w) x_n+1 - (1+w) x_n + w^2/(1+w) x_n-1) / h.
+IntegrationStep IntegrationStep::make(IntegrationMethod method, double h, double previousStep) {
+    IntegrationStep step;
+    step.method = method;
+    step.h = h;
+    switch (method) {
+    case IntegrationMethod::TRAPEZOIDAL:
+        step.alpha = 2.0;
+        step.beta1 = 2.0;
+        step.gamma = 1.0;
+        break;
+    case IntegrationMethod::BDF2: {
+        double w = h / previousStep;
+        step.alpha = (1.0 + 2.0 * w) / (1.0 + w);
+        step.beta1 = 1.0 + w;
+        step.beta2 = -w * w / (1.0 + w);
+        break;
     }
-    if (!n2_is_ground) {
-        v2 = solution(nodeIdToMnaIndex.at(node2));
+    default:
+        break;
     }
+    return step;
+}
+// -------------------------------- Integration formulas --------------------------------
+
 
-    V_prev = v1 - v2;
+// -------------------------------- Update state implementation --------------------------------
+double Component::branchVoltage(const Eigen::VectorXd& solution) const {
+    double v1 = (n1Index == -1) ? 0.0 : solution(n1Index);
+    double v2 = (n2Index == -1) ? 0.0 : solution(n2Index);
+    return v1 - v2;
 }
 
-void Inductor::updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) {
-    auto it = ci.find(name);
-    if (it != ci.end()) {
-        I_prev = solution(it->second);
+void Capacitor::updateState(const Eigen::VectorXd& solution) {
+    double V = branchVoltage(solution);
+    if (step.h != 0.0)
+        I_prev = (value / step.h) * (step.alpha * V - step.beta1 * V_prev - step.beta2 * V_prev2) - step.gamma * I_prev;
+    V_prev2 = V_prev;
+    V_prev = V;
+}
+
+void Inductor::updateState(const Eigen::VectorXd& solution) {
+    if (branchIndex != -1) {
+        I_prev2 = I_prev;
+        I_prev = solution(branchIndex);
+        V_prev = branchVoltage(solution);
     }
 }
 
-void Diode::updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) {
-    double v1 = 0.0, v2 = 0.0;
+void Diode::updateState(const Eigen::VectorXd& solution) {
+    const double V_new = branchVoltage(solution);
+    V_prev = limitJunctionVoltage(V_new);
+    limited = V_prev != V_new;
+    updateLinearization();
+}
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+// SPICE pnjlim: above the critical voltage, where the exponential turns steep, a forward step
+// of more than 2*eta*Vt is cut back to the voltage at which the linearized current would be
+// reached, i.e. the step moves along the current axis instead of the voltage axis.
+double Diode::limitJunctionVoltage(double V_new) const {
+    const double nVt = eta * Vt;
+    const double Vcrit = nVt * std::log(nVt / (std::sqrt(2.0) * Is));
+    if (V_new <= Vcrit || std::abs(V_new - V_prev) <= 2.0 * nVt)
+        return V_new;
+    if (V_prev <= 0.0)
+        return nVt * std::log(V_new / nVt);
+    const double arg = 1.0 + (V_new - V_prev) / nVt;
+    return arg > 0.0 ? V_prev + nVt * std::log(arg) : Vcrit;
+}
 
-    if (!n1_is_ground) {
-        v1 = solution(nodeIdToMnaIndex.at(node1));
-    }
-    if (!n2_is_ground) {
-        v2 = solution(nodeIdToMnaIndex.at(node2));
-    }
+void Diode::linearizeAt(const Eigen::VectorXd& solution) {
+    V_prev = branchVoltage(solution);
+    limited = false;
+    updateLinearization();
+}
 
-    V_prev = v1 - v2;
+bool Diode::canBypass(const Eigen::VectorXd& solution, double tolerance) const {
+    return std::abs(branchVoltage(solution) - V_prev) <= tolerance;
+}
+
+// Companion model of the diode around V_prev, shared by the matrix and RHS stamps.
+void Diode::updateLinearization() {
+    const double Gmin = 1e-12;
+
+    const double expTerm = exp(V_prev / (eta * Vt));
+    const double I = Is * (expTerm - 1.0);
+    Gd = (Is / (eta * Vt)) * expTerm + Gmin;
+    Ieq = I - Gd * V_prev;
 }
 // -------------------------------- Update state implementation --------------------------------
 
 
 // -------------------------------- Reset initial values --------------------------------
 void Capacitor::reset() {
-    V_prev = 0.0;
+    V_prev = V_prev2 = I_prev = 0.0;
+    step = IntegrationStep();
 }
 
 void Inductor::reset() {
-    I_prev = 0.0;
+    I_prev = I_prev2 = V_prev = 0.0;
+    step = IntegrationStep();
 }
 
 void Diode::reset() {
     V_prev = 0.0;
+    limited = false;
+    updateLinearization();
 }
 // -------------------------------- Reset initial values --------------------------------
 
 
-// -------------------------------- MNA Stamping Implementations for AC Sweep --------------------------------
-void Resistor::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+// -------------------------------- Stamping helpers --------------------------------
+// Conductance g between MNA rows a and b; -1 stands for ground and is skipped.
+void Component::stampConductance(MNATriplets& A, int a, int b, double g) {
+    if (a != -1)
+        A.emplace_back(a, a, g);
+    if (b != -1)
+        A.emplace_back(b, b, g);
+    if (a != -1 && b != -1) {
+        A.emplace_back(a, b, -g);
+        A.emplace_back(b, a, -g);
+    }
 }
 
-void Capacitor::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    double admittance = omega * value;
-    if (admittance < 1e-12)
-        admittance = 1e-12;
-
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
-
-    if (!n1_is_ground)
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += admittance;
-    if (!n2_is_ground)
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += admittance;
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= admittance;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= admittance;
+// +1/-1 incidence of a branch current unknown on its two terminals (KCL columns and branch equation row).
+void Component::stampBranchIncidence(MNATriplets& A, int a, int b, int branch) {
+    if (a != -1) {
+        A.emplace_back(a, branch, 1.0);
+        A.emplace_back(branch, a, 1.0);
+    }
+    if (b != -1) {
+        A.emplace_back(b, branch, -1.0);
+        A.emplace_back(branch, b, -1.0);
     }
 }
+// -------------------------------- Stamping helpers --------------------------------
 
-void Inductor::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    if (omega < 1e-9)
-        omega = 1e-9;
-    double admittance = 1.0 / (omega * value);
-
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
 
-    if (!n1_is_ground)
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += admittance;
-    if (!n2_is_ground)
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += admittance;
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= admittance;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= admittance;
-    }
+// -------------------------------- MNA Stamping Implementations for AC Sweep --------------------------------
+// Independent DC sources are zeroed in the small-signal circuit; the diode uses its
+// conductance at the DC operating point, where runACAnalysis linearizes it.
+void Resistor::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
 
-void Diode::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    double conductance = 1.0;
+void Capacitor::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampConductance(C, n1Index, n2Index, value);
+}
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+void Inductor::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    if (branchIndex == -1)
+        return;
 
-    if (!n1_is_ground)
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += conductance;
-    if (!n2_is_ground)
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += conductance;
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= conductance;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= conductance;
-    }
+    // Branch equation: V1 - V2 - j*omega*L*I = 0
+    stampBranchIncidence(G, n1Index, n2Index, branchIndex);
+    C.emplace_back(branchIndex, branchIndex, -value);
 }
 
-void VoltageSource::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void Diode::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampConductance(G, n1Index, n2Index, Gd);
 }
-void ACVoltageSource::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, omega, 0, idx);
+
+void VoltageSource::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
-void CurrentSource::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void ACVoltageSource::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
+    if (branchIndex != -1)
+        b(branchIndex) += value;
 }
-void VCVS::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void CurrentSource::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {}
+void VCVS::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
-void VCCS::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void VCCS::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
-void CCVS::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void CCVS::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
-void CCCS::stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) {
-    stampMNA(A, b, ci, nodeIdToMnaIndex, 0, 0, idx);
+void CCCS::stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) {
+    stampMatrix(G, 0, 0);
 }
 // -------------------------------- MNA Stamping Implementations for AC Sweep --------------------------------
 
 
 // -------------------------------- MNA Stamping Implementations --------------------------------
-void Resistor::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    double conductance = 1.0 / value;
+void Component::stampMNA(MNATriplets& A, Eigen::VectorXd& b, double time, double h) {
+    stampMatrix(A, time, h);
+    stampRHS(b, time, h);
+}
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+void Resistor::stampMatrix(MNATriplets& A, double time, double h) {
+    double conductance = 1.0 / value;
 
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += conductance;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += conductance;
-    }
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= conductance;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= conductance;
-    }
+    stampConductance(A, n1Index, n2Index, conductance);
 }
 
-void Capacitor::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
+void Capacitor::stampMatrix(MNATriplets& A, double time, double h) {
     // For DC analysis (h=0), a capacitor is an open circuit, so we do nothing.
     if (h == 0.0)
         return;
 
-    double G_eq = value / h;
-    double I_eq = G_eq * V_prev;
-
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+    double G_eq = step.alpha * value / h;
 
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += G_eq;
-        b(nodeIdToMnaIndex.at(node1)) += I_eq;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += G_eq;
-        b(nodeIdToMnaIndex.at(node2)) -= I_eq;
-    }
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= G_eq;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= G_eq;
-    }
+    stampConductance(A, n1Index, n2Index, G_eq);
 }
 
-void Inductor::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    if (idx == -1) {
-        std::cerr << "ERROR: Inductor '" << name << "' was not assigned a current index." << std::endl;
+void Capacitor::stampRHS(Eigen::VectorXd& b, double time, double h) {
+    if (h == 0.0)
         return;
-    }
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+    double I_eq = (value / h) * (step.beta1 * V_prev + step.beta2 * V_prev2) + step.gamma * I_prev;
 
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), idx) += 1.0;
-        A(idx, nodeIdToMnaIndex.at(node1)) += 1.0;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), idx) -= 1.0;
-        A(idx, nodeIdToMnaIndex.at(node2)) -= 1.0;
-    }
+    if (n1Index != -1)
+        b(n1Index) += I_eq;
+    if (n2Index != -1)
+        b(n2Index) -= I_eq;
+}
 
-    if (h != 0.0) {
-        A(idx, idx) -= value / h; // Change D matrix in A
-        b(idx) -= (value / h) * I_prev;  // Change the RHS matrix
+void Inductor::stampMatrix(MNATriplets& A, double time, double h) {
+    if (branchIndex == -1) {
+        std::cerr << "ERROR: Inductor '" << name << "' was not assigned a current index." << std::endl;
+        return;
     }
-}
 
-void Diode::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    const double Gmin = 1e-12;
+    stampBranchIncidence(A, n1Index, n2Index, branchIndex);
 
-    const double I = Is * (exp(V_prev / (eta * Vt)) - 1.0);
-    const double Gd = (Is / (eta * Vt)) * exp(V_prev / (eta * Vt)) + Gmin;
-    const double Ieq = I - Gd * V_prev;
+    if (h != 0.0)
+        A.emplace_back(branchIndex, branchIndex, -step.alpha * value / h); // Change D matrix in A
+}
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+void Inductor::stampRHS(Eigen::VectorXd& b, double time, double h) {
+    if (branchIndex != -1 && h != 0.0)
+        b(branchIndex) -= (value / h) * (step.beta1 * I_prev + step.beta2 * I_prev2) + step.gamma * V_prev;  // Change the RHS matrix
+}
 
-    if (!n1_is_ground)
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node1)) += Gd;
-    if (!n2_is_ground)
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node2)) += Gd;
-    if (!n1_is_ground && !n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(node2)) -= Gd;
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(node1)) -= Gd;
-    }
+void Diode::stampMatrix(MNATriplets& A, double time, double h) {
+    stampConductance(A, n1Index, n2Index, Gd);
+}
 
-    if (!n1_is_ground) {
-        b(nodeIdToMnaIndex.at(node1)) -= Ieq;
+void Diode::stampRHS(Eigen::VectorXd& b, double time, double h) {
+    if (n1Index != -1) {
+        b(n1Index) -= Ieq;
     }
-    if (!n2_is_ground) {
-        b(nodeIdToMnaIndex.at(node2)) += Ieq;
+    if (n2Index != -1) {
+        b(n2Index) += Ieq;
     }
 }
 
-void VoltageSource::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci,const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    if (idx == -1) {
+void VoltageSource::stampMatrix(MNATriplets& A, double time, double h) {
+    if (branchIndex == -1) {
         std::cerr << "ERROR: VoltageSource '" << name << "' was not assigned a current index." << std::endl;
         return;
     }
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
-
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), idx) += 1.0;
-        A(idx, nodeIdToMnaIndex.at(node1)) += 1.0;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), idx) -= 1.0;
-        A(idx, nodeIdToMnaIndex.at(node2)) -= 1.0;
-    }
+    stampBranchIncidence(A, n1Index, n2Index, branchIndex);
+}
 
-    b(idx) += getCurrentValue(time);
+void VoltageSource::stampRHS(Eigen::VectorXd& b, double time, double h) {
+    if (branchIndex != -1)
+        b(branchIndex) += getCurrentValue(time);
 }
 
-void ACVoltageSource::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci,const std::map<int, int>& nodeIdToMnaIndex, double timeOrOmega, double h, int idx) {
-    if (idx == -1) {
+void ACVoltageSource::stampMatrix(MNATriplets& A, double timeOrOmega, double h) {
+    if (branchIndex == -1) {
         std::cerr << "ERROR: VoltageSource '" << name << "' was not assigned a current index." << std::endl;
         return;
     }
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
-
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), idx) += 1.0;
-        A(idx, nodeIdToMnaIndex.at(node1)) += 1.0;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), idx) -= 1.0;
-        A(idx, nodeIdToMnaIndex.at(node2)) -= 1.0;
-    }
+    stampBranchIncidence(A, n1Index, n2Index, branchIndex);
+}
 
-    b(idx) += getValueAtFrequency(timeOrOmega);
+void ACVoltageSource::stampRHS(Eigen::VectorXd& b, double timeOrOmega, double h) {
+    if (branchIndex != -1)
+        b(branchIndex) += getValueAtFrequency(timeOrOmega);
 }
 
-void CurrentSource::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex,double time, double h, int idx) {
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+void CurrentSource::stampRHS(Eigen::VectorXd& b, double time, double h) {
+    double current = getCurrentValue(time);
 
-    if (!n1_is_ground) {
-        b(nodeIdToMnaIndex.at(node1)) -= getCurrentValue(time);
+    if (n1Index != -1) {
+        b(n1Index) -= current;
     }
-    if (!n2_is_ground) {
-        b(nodeIdToMnaIndex.at(node2)) += getCurrentValue(time);
+    if (n2Index != -1) {
+        b(n2Index) += current;
     }
 }
 
-void VCVS::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex,double time, double h, int idx) {
-    if (idx == -1) {
+void VCVS::stampMatrix(MNATriplets& A, double time, double h) {
+    if (branchIndex == -1) {
         std::cerr << "ERROR: VCVS '" << name << "' was not assigned a current index." << std::endl;
         return;
     }
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
-
-    if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), idx) += 1.0;
-        A(idx, nodeIdToMnaIndex.at(node1)) += 1.0;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), idx) -= 1.0;
-        A(idx, nodeIdToMnaIndex.at(node2)) -= 1.0;
-    }
+    stampBranchIncidence(A, n1Index, n2Index, branchIndex);
 
-    if (nodeIdToMnaIndex.count(ctrlNode1)) {
-        A(idx, nodeIdToMnaIndex.at(ctrlNode1)) -= gain;
+    if (ctrlIndex1 != -1) {
+        A.emplace_back(branchIndex, ctrlIndex1, -gain);
     }
-    if (nodeIdToMnaIndex.count(ctrlNode2)) {
-        A(idx, nodeIdToMnaIndex.at(ctrlNode2)) += gain;
+    if (ctrlIndex2 != -1) {
+        A.emplace_back(branchIndex, ctrlIndex2, gain);
     }
 }
 
-void VCCS::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex,double time, double h, int idx) {
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
-    bool ctrlNode1_is_ground = !nodeIdToMnaIndex.count(ctrlNode1);
-    bool ctrlNode2_is_ground = !nodeIdToMnaIndex.count(ctrlNode2);
-
-    if (!n1_is_ground && !ctrlNode1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(ctrlNode1)) += gain;
+void VCCS::stampMatrix(MNATriplets& A, double time, double h) {
+    if (n1Index != -1 && ctrlIndex1 != -1) {
+        A.emplace_back(n1Index, ctrlIndex1, gain);
     }
-    if (!n1_is_ground && !ctrlNode2_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), nodeIdToMnaIndex.at(ctrlNode2)) -= gain;
+    if (n1Index != -1 && ctrlIndex2 != -1) {
+        A.emplace_back(n1Index, ctrlIndex2, -gain);
     }
-    if (!n2_is_ground && !ctrlNode1_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(ctrlNode1)) -= gain;
+    if (n2Index != -1 && ctrlIndex1 != -1) {
+        A.emplace_back(n2Index, ctrlIndex1, -gain);
     }
-    if (!n2_is_ground && !ctrlNode2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), nodeIdToMnaIndex.at(ctrlNode2)) += gain;
+    if (n2Index != -1 && ctrlIndex2 != -1) {
+        A.emplace_back(n2Index, ctrlIndex2, gain);
     }
 }
 
-void CCVS::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci,const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    if (idx == -1) {
+void CCVS::stampMatrix(MNATriplets& A, double time, double h) {
+    if (branchIndex == -1) {
         std::cerr << "ERROR: CCVS '" << name << "' was not assigned a current index." << std::endl;
         return;
     }
-
-    auto it = ci.find(ctrlCompName);
-    if (it == ci.end()) {
-        std::cerr << "ERROR: Controlling component '" << ctrlCompName << "' for CCVS '" << name << "' not found or has no current." << std::endl;
+    if (sourceIndex == -1)
         return;
-    }
-    int ctrl_idx = it->second;
 
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
+    stampBranchIncidence(A, n1Index, n2Index, branchIndex);
 
-     if (!n1_is_ground) {
-        A(nodeIdToMnaIndex.at(node1), idx) += 1.0;
-        A(idx, nodeIdToMnaIndex.at(node1)) += 1.0;
-    }
-    if (!n2_is_ground) {
-        A(nodeIdToMnaIndex.at(node2), idx) -= 1.0;
-        A(idx, nodeIdToMnaIndex.at(node2)) -= 1.0;
-    }
-
-    A(idx, ctrl_idx) -= gain;
+    A.emplace_back(branchIndex, sourceIndex, -gain);
 }
 
-void CCCS::stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci,const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) {
-    auto it = ci.find(ctrlCompName);
-    if (it == ci.end()) {
-        std::cerr << "ERROR: Controlling component '" << ctrlCompName << "' for CCCS '" << name << "' not found or has no current." << std::endl;
+void CCCS::stampMatrix(MNATriplets& A, double time, double h) {
+    if (sourceIndex == -1)
         return;
-    }
-    int ctrl_idx = it->second;
-
-    bool n1_is_ground = !nodeIdToMnaIndex.count(node1);
-    bool n2_is_ground = !nodeIdToMnaIndex.count(node2);
 
-    if (!n1_is_ground)
-        A(nodeIdToMnaIndex.at(node1), ctrl_idx) += gain;
-    if (!n2_is_ground)
-        A(nodeIdToMnaIndex.at(node2), ctrl_idx) -= gain;
+    if (n1Index != -1)
+        A.emplace_back(n1Index, sourceIndex, gain);
+    if (n2Index != -1)
+        A.emplace_back(n2Index, sourceIndex, -gain);
 }
 // -------------------------------- MNA Stamping Implementations --------------------------------
 
@@ -435,15 +458,31 @@ void CurrentSource::setValue(double i) {
 double VoltageSource::getCurrentValue(double time) const {
     if (sourceType == SourceType::DC)
         return param1;
-    else
+    else if (sourceType == SourceType::Sinusoidal)
         return param1 + param2 * sin(2*PI*param3*time);
+    else
+        return waveform.value(time);
 }
 
 double CurrentSource::getCurrentValue(double time) const {
     if (sourceType == SourceType::DC)
         return param1;
-    else
+    else if (sourceType == SourceType::Sinusoidal)
         return param1 + param2 * sin(2*PI*param3*time);
+    else
+        return waveform.value(time);
+}
+
+double VoltageSource::nextBreakpoint(double time) const {
+    if (sourceType == SourceType::Pulse || sourceType == SourceType::PWL)
+        return waveform.nextBreakpoint(time);
+    return Component::nextBreakpoint(time);
+}
+
+double CurrentSource::nextBreakpoint(double time) const {
+    if (sourceType == SourceType::Pulse || sourceType == SourceType::PWL)
+        return waveform.nextBreakpoint(time);
+    return Component::nextBreakpoint(time);
 }
 
 double ACVoltageSource::getValueAtFrequency(double omega) const {
@@ -452,6 +491,83 @@ double ACVoltageSource::getValueAtFrequency(double omega) const {
 // -------------------------------- Get Values of independent sources --------------------------------
 
 
+// -------------------------------- Source waveforms --------------------------------
+SourceWaveform SourceWaveform::pulse(const std::vector<double>& params) {
+    if (params.size() != 7)
+        throw std::runtime_error("PULSE needs 7 parameters: v1 v2 delay rise fall width period.");
+    const double v1 = params[0], v2 = params[1], rise = params[3], fall = params[4], width = params[5];
+    if (params[2] < 0 || rise < 0 || fall < 0 || width < 0 || params[6] < 0)
+        throw std::runtime_error("PULSE times cannot be negative.");
+
+    SourceWaveform waveform;
+    waveform.params = params;
+    waveform.delay = params[2];
+    waveform.times = {0.0, rise, rise + width, rise + width + fall};
+    waveform.values = {v1, v2, v2, v1};
+    if (params[6] > 0) {
+        waveform.period = std::max(params[6], rise + width + fall);
+        waveform.times.push_back(waveform.period);
+        waveform.values.push_back(v1);
+    }
+    return waveform;
+}
+
+SourceWaveform SourceWaveform::piecewiseLinear(const std::vector<double>& params) {
+    if (params.size() < 2 || params.size() % 2 != 0)
+        throw std::runtime_error("PWL needs time-value pairs.");
+
+    SourceWaveform waveform;
+    waveform.params = params;
+    for (size_t i = 0; i < params.size(); i += 2) {
+        if (!waveform.times.empty() && params[i] < waveform.times.back())
+            throw std::runtime_error("PWL times must not decrease.");
+        waveform.times.push_back(params[i]);
+        waveform.values.push_back(params[i + 1]);
+    }
+    return waveform;
+}
+
+double SourceWaveform::value(double time) const {
+    if (times.empty())
+        return 0.0;
+    double local = time - delay;
+    if (period > 0 && local > 0)
+        local = std::fmod(local, period);
+    if (local < times.front())
+        return values.front();
+    if (local >= times.back())
+        return values.back();
+
+    // times[cursor] <= local < times[cursor + 1], which also keeps equal corner times
+    // (zero rise or fall) from being interpolated.
+    if (cursor + 1 >= times.size())
+        cursor = 0;
+    while (times[cursor] > local)
+        --cursor;
+    while (times[cursor + 1] <= local)
+        ++cursor;
+    double fraction = (local - times[cursor]) / (times[cursor + 1] - times[cursor]);
+    return values[cursor] + fraction * (values[cursor + 1] - values[cursor]);
+}
+
+double SourceWaveform::nextBreakpoint(double time) const {
+    double local = time - delay;
+    double base = delay;
+    if (period > 0 && local >= 0) {
+        double cycles = std::floor(local / period);
+        base += cycles * period;
+        local -= cycles * period;
+    }
+    auto next = std::upper_bound(times.begin(), times.end(), local);
+    if (next != times.end())
+        return base + *next;
+    if (period > 0)
+        return base + period + times.front();
+    return std::numeric_limits<double>::infinity();
+}
+// -------------------------------- Source waveforms --------------------------------
+
+
 // -------------------------------- Fuck --------------------------------
 void Component::serialize(QDataStream& out) const {
     out << QString::fromStdString(name) << (qint32)node1 << (qint32)node2 << value;
@@ -474,15 +590,36 @@ void Capacitor::deserialize(QDataStream& in) {
     in >> V_prev;
 }
 
+// Pulse and PWL sources append their waveform parameters; DC and sinusoidal records are unchanged.
+static void serializeWaveform(QDataStream& out, const SourceWaveform& waveform) {
+    out << (qint32)waveform.getParams().size();
+    for (double p : waveform.getParams())
+        out << p;
+}
+static std::vector<double> deserializeWaveformParams(QDataStream& in) {
+    qint32 count;
+    in >> count;
+    std::vector<double> params(std::max<qint32>(count, 0));
+    for (double& p : params)
+        in >> p;
+    return params;
+}
+
 void VoltageSource::serialize(QDataStream& out) const {
     Component::serialize(out);
     out << (qint32)sourceType << param1 << param2 << param3;
+    if (sourceType == SourceType::Pulse || sourceType == SourceType::PWL)
+        serializeWaveform(out, waveform);
 }
 void VoltageSource::deserialize(QDataStream& in) {
     Component::deserialize(in);
     qint32 st;
     in >> st >> param1 >> param2 >> param3;
     sourceType = (SourceType)st;
+    if (sourceType == SourceType::Pulse)
+        waveform = SourceWaveform::pulse(deserializeWaveformParams(in));
+    else if (sourceType == SourceType::PWL)
+        waveform = SourceWaveform::piecewiseLinear(deserializeWaveformParams(in));
 }
 
 void Inductor::serialize(QDataStream& out) const {
@@ -501,17 +638,24 @@ void Diode::serialize(QDataStream& out) const {
 void Diode::deserialize(QDataStream& in) {
     Component::deserialize(in);
     in >> Is >> Vt >> eta >> V_prev;
+    updateLinearization();
 }
 
 void CurrentSource::serialize(QDataStream& out) const {
     Component::serialize(out);
     out << (qint32)sourceType << param1 << param2 << param3;
+    if (sourceType == SourceType::Pulse || sourceType == SourceType::PWL)
+        serializeWaveform(out, waveform);
 }
 void CurrentSource::deserialize(QDataStream& in) {
     Component::deserialize(in);
     qint32 st;
     in >> st >> param1 >> param2 >> param3;
     sourceType = (SourceType)st;
+    if (sourceType == SourceType::Pulse)
+        waveform = SourceWaveform::pulse(deserializeWaveformParams(in));
+    else if (sourceType == SourceType::PWL)
+        waveform = SourceWaveform::piecewiseLinear(deserializeWaveformParams(in));
 }
 
 void VCVS::serialize(QDataStream& out) const {
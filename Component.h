@@ -2,11 +2,14 @@
 #define COMPONENT_H
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 #include <QString>
 #include <string>
 #include <iostream>
 #include <memory>
 #include <map>
+#include <vector>
+#include <limits>
 #include <fstream>
 #include <QDataStream>
 
@@ -14,6 +17,24 @@ class Circuit;
 
 const double PI = 3.141592;
 
+// MNA matrix entries are stamped as (row, col, value) triplets; duplicates are summed on assembly.
+using MNATriplets = std::vector<Eigen::Triplet<double>>;
+
+enum class IntegrationMethod { BACKWARD_EULER, TRAPEZOIDAL, BDF2 };
+
+// Integration formula of one transient step, shared by all reactive devices. With state x
+// (capacitor voltage, inductor current) the derivative at the new point is
+//   x'_n+1 = (alpha x_n+1 - beta1 x_n - beta2 x_n-1) / h - gamma x'_n
+struct IntegrationStep {
+    IntegrationMethod method = IntegrationMethod::BACKWARD_EULER;
+    double h = 0.0;
+    double alpha = 1.0, beta1 = 1.0, beta2 = 0.0, gamma = 0.0;
+
+    // previousStep is only used by BDF2, whose coefficients depend on the step ratio.
+    static IntegrationStep make(IntegrationMethod method, double h, double previousStep);
+    int order() const { return method == IntegrationMethod::BACKWARD_EULER ? 1 : 2; }
+};
+
 // -------------------------------- Component Class and Its Implementations --------------------------------
 class Component {
 public:
@@ -33,44 +54,90 @@ public:
     int node2;
     double value;
 
-    Component() : type(Type::RESISTOR), node1(-1), node2(-1), value(0.0) {}
-    Component(Type t, const std::string& n, int n1, int n2, double v) : type(t), name(std::move(n)), node1(n1), node2(n2), value(v) {}
+    // What a device's matrix stamp depends on (bit flags). The RHS is re-stamped on every build.
+    enum MatrixDependency {
+        STATIC_MATRIX = 0,
+        DEPENDS_ON_TIME = 1 << 0,
+        DEPENDS_ON_STEP = 1 << 1,
+        DEPENDS_ON_ITERATE = 1 << 2
+    };
+
+    // MNA positions resolved once per topology by compile(); -1 means ground / no branch current.
+    int n1Index;
+    int n2Index;
+    int branchIndex;
+
+    Component() : type(Type::RESISTOR), node1(-1), node2(-1), value(0.0), n1Index(-1), n2Index(-1), branchIndex(-1) {}
+    Component(Type t, const std::string& n, int n1, int n2, double v) : type(t), name(std::move(n)), node1(n1), node2(n2), value(v), n1Index(-1), n2Index(-1), branchIndex(-1) {}
     virtual ~Component() {}
 
     virtual void reset() {}
-    virtual void stampMNA(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int> &ci,
-        const std::map<int, int>& nodeIdToMnaIndex, double time, double h, int idx) = 0;
-    virtual void stampMNA_AC(Eigen::MatrixXd& A, Eigen::VectorXd& b, const std::map<std::string, int>& ci,
-        const std::map<int, int>& nodeIdToMnaIndex, double omega, int idx) = 0;
-    virtual void updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) {}
+    virtual void compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx);
+    void stampMNA(MNATriplets& A, Eigen::VectorXd& b, double time, double h);
+    virtual void stampMatrix(MNATriplets& A, double time, double h) {}
+    virtual void stampRHS(Eigen::VectorXd& b, double time, double h) {}
+    virtual int matrixDependencies() const { return STATIC_MATRIX; }
+    // Small-signal AC stamp, split so that the system at omega is (G + j*omega*C) x = b.
+    virtual void stampMNA_AC(MNATriplets& G, MNATriplets& C, Eigen::VectorXcd& b) = 0;
+    virtual void updateState(const Eigen::VectorXd& solution) {}
+    // Device bypass: true when a nonlinear device's controlling voltage in solution is within
+    // tolerance of its last linearization point, so updateState can be skipped.
+    virtual bool canBypass(const Eigen::VectorXd& solution, double tolerance) const { return false; }
     virtual bool isNonlinear() const { return false; }
+    // True when the last updateState limited the step of a junction voltage, i.e. the device
+    // is linearized away from solution and Newton has not converged yet.
+    virtual bool stateLimited() const { return false; }
+    // Nonlinear devices: linearize exactly at solution, without limiting the step from the
+    // previous linearization (used to return to an earlier converged solution).
+    virtual void linearizeAt(const Eigen::VectorXd& solution) { updateState(solution); }
+    // Reactive devices: the quantity their companion model integrates (capacitor voltage,
+    // inductor current) as found in solution. Drives the local truncation error estimate.
+    virtual bool isReactive() const { return false; }
+    virtual double integratedQuantity(const Eigen::VectorXd& solution) const { return 0.0; }
+    virtual void setIntegrationStep(const IntegrationStep& step) {}
+    // First corner of the device's waveform strictly after time (infinity if none), so the
+    // transient stepper can land on it.
+    virtual double nextBreakpoint(double time) const { return std::numeric_limits<double>::infinity(); }
     virtual std::string getName() const { return name; }
     virtual bool needsCurrentUnknown() const { return false; }
 
     virtual QString getTypeString() const = 0;
     virtual void serialize(QDataStream& out) const;
     virtual void deserialize(QDataStream& in);
+
+protected:
+    double branchVoltage(const Eigen::VectorXd& solution) const;
+    static void stampConductance(MNATriplets& A, int a, int b, double g);
+    static void stampBranchIncidence(MNATriplets& A, int a, int b, int branch);
 };
 
 class Resistor : public Component {
 public:
     Resistor() : Component() {}
     Resistor(const std::string& n, int n1, int n2, double v);
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &,const std::map<int, int>& nodeIdToMnaIndex,  double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
     QString getTypeString() const override { return "Resistor"; }
 };
 
 class Capacitor : public Component {
 private:
     double V_prev;
+    double V_prev2; // one more accepted point back (BDF2)
+    double I_prev;  // capacitor current at V_prev (trapezoidal)
+    IntegrationStep step;
 public:
-    Capacitor() : Component(), V_prev(0.0) {}
+    Capacitor() : Component(), V_prev(0.0), V_prev2(0.0), I_prev(0.0) {}
     Capacitor(const std::string& n, int n1, int n2, double v);
-    void updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) override;
+    void updateState(const Eigen::VectorXd& solution) override;
+    bool isReactive() const override { return true; }
+    double integratedQuantity(const Eigen::VectorXd& solution) const override { return branchVoltage(solution); }
+    void setIntegrationStep(const IntegrationStep& s) override { step = s; }
     void reset() override;
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    int matrixDependencies() const override { return DEPENDS_ON_STEP; }
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "Capacitor"; }
     void serialize(QDataStream& out) const override;
@@ -80,14 +147,22 @@ public:
 class Inductor : public Component {
 private:
     double I_prev;
+    double I_prev2; // one more accepted point back (BDF2)
+    double V_prev;  // inductor voltage at I_prev (trapezoidal)
+    IntegrationStep step;
 public:
-    Inductor() : Component(), I_prev(0.0) {}
+    Inductor() : Component(), I_prev(0.0), I_prev2(0.0), V_prev(0.0) {}
     Inductor(const std::string& n, int n1, int n2, double v);
     bool needsCurrentUnknown() const override { return true; }
-    void updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) override;
+    void updateState(const Eigen::VectorXd& solution) override;
+    bool isReactive() const override { return true; }
+    double integratedQuantity(const Eigen::VectorXd& solution) const override { return branchIndex == -1 ? 0.0 : solution(branchIndex); }
+    void setIntegrationStep(const IntegrationStep& s) override { step = s; }
     void reset() override;
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &,const std::map<int, int>& nodeIdToMnaIndex,  double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    int matrixDependencies() const override { return DEPENDS_ON_STEP; }
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "Inductor"; }
     void serialize(QDataStream& out) const override;
@@ -100,14 +175,24 @@ private:
     double Vt;
     double eta;
     double V_prev;
+    double Gd, Ieq; // companion model at V_prev
+    bool limited;   // the last update clipped the junction voltage step
+
+    void updateLinearization();
+    double limitJunctionVoltage(double V_new) const;
 public:
-    Diode() : Component(), Is(1e-12), Vt(0.026), eta(1.0), V_prev(0.7) {}
+    Diode() : Component(), Is(1e-12), Vt(0.026), eta(1.0), V_prev(0.7), limited(false) { updateLinearization(); }
     Diode(const std::string& n, int n1, int n2, double Is = 1e-12, double eta = 1.0, double Vt = 0.026);
     bool isNonlinear() const override { return true; }
-    void updateState(const Eigen::VectorXd& solution, const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex) override;
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
-    void setPreviousVoltage(double v) { V_prev = v; }
+    void updateState(const Eigen::VectorXd& solution) override;
+    bool canBypass(const Eigen::VectorXd& solution, double tolerance) const override;
+    bool stateLimited() const override { return limited; }
+    void linearizeAt(const Eigen::VectorXd& solution) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    int matrixDependencies() const override { return DEPENDS_ON_ITERATE; }
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
+    void setPreviousVoltage(double v) { V_prev = v; updateLinearization(); }
     void reset() override;
 
     QString getTypeString() const override { return "Diode"; }
@@ -115,24 +200,53 @@ public:
     void deserialize(QDataStream& in) override;
 };
 
+// Piecewise-linear shape of a PULSE or PWL source: corner points, optionally repeated with
+// a period after a delay. value() keeps a cursor on the segment of the last query, so the
+// increasing times of a transient run cost O(1) amortized instead of a table search.
+class SourceWaveform {
+public:
+    SourceWaveform() : delay(0.0), period(0.0), cursor(0) {}
+    // PULSE(v1 v2 delay rise fall width period); period 0 gives a single pulse.
+    static SourceWaveform pulse(const std::vector<double>& params);
+    // PWL(t0 v0 t1 v1 ...) with non-decreasing times; the end values hold outside the table.
+    static SourceWaveform piecewiseLinear(const std::vector<double>& params);
+
+    double value(double time) const;
+    double nextBreakpoint(double time) const;
+    const std::vector<double>& getParams() const { return params; }
+
+private:
+    std::vector<double> params; // as given, for the netlist and serialization
+    std::vector<double> times;  // corners, relative to delay (and within one period)
+    std::vector<double> values;
+    double delay;
+    double period;
+    mutable size_t cursor;
+};
+
 class VoltageSource : public Component {
 public:
-    enum class SourceType {DC, Sinusoidal};
+    enum class SourceType {DC, Sinusoidal, Pulse, PWL};
 private:
     SourceType sourceType;
     double param1, param2, param3;
+    SourceWaveform waveform; // Pulse and PWL
 public:
     VoltageSource() : Component(), sourceType(SourceType::DC), param1(0), param2(0), param3(0) {}
     VoltageSource(const std::string& name, int node1, int node2, SourceType type, double p1, double p2, double p3);
+    VoltageSource(const std::string& name, int node1, int node2, SourceType type, const std::vector<double>& waveformParams);
 
     SourceType getSourceType() const { return sourceType; }
     double getParam1() const { return param1; }
     double getParam2() const { return param2; }
     double getParam3() const { return param3; }
+    const std::vector<double>& getWaveformParams() const { return waveform.getParams(); }
+    double nextBreakpoint(double time) const override;
 
     bool needsCurrentUnknown() const override { return true; }
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
     void setValue(double v);
     double getCurrentValue(double time) const;
 
@@ -148,8 +262,9 @@ public:
     ACVoltageSource(const std::string& name, int node1, int node2);
 
     bool needsCurrentUnknown() const override { return true; }
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
     double getValueAtFrequency(double omega) const;
 
     QString getTypeString() const override { return "ACVoltageSource"; }
@@ -157,21 +272,25 @@ public:
 
 class CurrentSource : public Component {
 public:
-    enum class SourceType {DC, Sinusoidal};
+    enum class SourceType {DC, Sinusoidal, Pulse, PWL};
 private:
     SourceType sourceType;
     double param1, param2, param3;
+    SourceWaveform waveform; // Pulse and PWL
 public:
     CurrentSource() : Component(), sourceType(SourceType::DC), param1(0), param2(0), param3(0) {}
     CurrentSource(const std::string& n, int n1, int n2, SourceType type, double p1, double p2, double p3);
+    CurrentSource(const std::string& n, int n1, int n2, SourceType type, const std::vector<double>& waveformParams);
 
     SourceType getSourceType() const { return sourceType; }
     double getParam1() const { return param1; }
     double getParam2() const { return param2; }
     double getParam3() const { return param3; }
+    const std::vector<double>& getWaveformParams() const { return waveform.getParams(); }
+    double nextBreakpoint(double time) const override;
 
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void stampRHS(Eigen::VectorXd&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
     void setValue(double v);
     double getCurrentValue(double time) const;
 
@@ -184,9 +303,10 @@ public:
 class VCVS : public Component {
 private:
     int ctrlNode1, ctrlNode2;
+    int ctrlIndex1, ctrlIndex2;
     double gain;
 public:
-    VCVS() : Component(), ctrlNode1(0), ctrlNode2(0), gain(0.0) {}
+    VCVS() : Component(), ctrlNode1(0), ctrlNode2(0), ctrlIndex1(-1), ctrlIndex2(-1), gain(0.0) {}
     VCVS(const std::string& n, int n1, int n2, int ctrlN1, int ctrlN2, double gain);
 
     int getCtrlNode1() const {return ctrlNode1;}
@@ -194,8 +314,9 @@ public:
     double getGain() const {return gain;}
 
     bool needsCurrentUnknown() const override { return true; }
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "VCVS"; }
     void serialize(QDataStream& out) const override;
@@ -206,17 +327,19 @@ public:
 class VCCS : public Component {
 private:
     int ctrlNode1, ctrlNode2;
+    int ctrlIndex1, ctrlIndex2;
     double gain;
 public:
-    VCCS() : Component(), ctrlNode1(0), ctrlNode2(0), gain(0.0) {}
+    VCCS() : Component(), ctrlNode1(0), ctrlNode2(0), ctrlIndex1(-1), ctrlIndex2(-1), gain(0.0) {}
     VCCS(const std::string& n, int n1, int n2, int ctrlN1, int ctrlN2, double gain);
 
     int getCtrlNode1() const {return ctrlNode1;}
     int getCtrlNode2() const {return ctrlNode2;}
     double getGain() const {return gain;}
 
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>& nodeIdToMnaIndex, double, double , int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "VCCS"; }
     void serialize(QDataStream& out) const override;
@@ -238,8 +361,9 @@ public:
     int getSourceIndex() const {return sourceIndex;}
 
     bool needsCurrentUnknown() const override { return true; }
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "CCVS"; }
     void serialize(QDataStream& out) const override;
@@ -251,15 +375,17 @@ class CCCS : public Component {
 private:
     std::string ctrlCompName;
     double gain;
+    int sourceIndex;
 public:
-    CCCS() : Component(), ctrlCompName(""), gain(0.0) {}
+    CCCS() : Component(), ctrlCompName(""), gain(0.0), sourceIndex(-1) {}
     CCCS(const std::string& n, int n1, int n2, const std::string& ctrlComp, double gain);
 
     std::string getCtrlCompName() const {return ctrlCompName;}
     double getGain() const {return gain;}
 
-    void stampMNA(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int> &, const std::map<int, int>& nodeIdToMnaIndex, double, double, int) override;
-    void stampMNA_AC(Eigen::MatrixXd&, Eigen::VectorXd&, const std::map<std::string, int>&, const std::map<int, int>&, double, int) override;
+    void compile(const std::map<std::string, int>& ci, const std::map<int, int>& nodeIdToMnaIndex, int idx) override;
+    void stampMatrix(MNATriplets&, double, double) override;
+    void stampMNA_AC(MNATriplets&, MNATriplets&, Eigen::VectorXcd&) override;
 
     QString getTypeString() const override { return "CCCS"; }
     void serialize(QDataStream& out) const override;
@@ -29,7 +29,12 @@ Component* ComponentFactory::createComponent(
         newComp = new Inductor(name, n1_id, n2_id, value);
     }
     else if (typeStr == "V") {
-        if (isSinusoidal)
+        // stringParams[0] tags a PULSE or PWL source whose parameters are numericParams.
+        if (!stringParams.empty() && stringParams[0] == "PULSE")
+            newComp = new VoltageSource(name, n1_id, n2_id, VoltageSource::SourceType::Pulse, numericParams);
+        else if (!stringParams.empty() && stringParams[0] == "PWL")
+            newComp = new VoltageSource(name, n1_id, n2_id, VoltageSource::SourceType::PWL, numericParams);
+        else if (isSinusoidal)
             newComp = new VoltageSource(name, n1_id, n2_id, VoltageSource::SourceType::Sinusoidal, numericParams[0], numericParams[1], numericParams[2]);
         else
             newComp = new VoltageSource(name, n1_id, n2_id, VoltageSource::SourceType::DC, value, 0.0, 0.0);
@@ -38,7 +43,11 @@ Component* ComponentFactory::createComponent(
         newComp = new ACVoltageSource(name, n1_id, n2_id);
     }
     else if (typeStr == "I") {
-        if (isSinusoidal)
+        if (!stringParams.empty() && stringParams[0] == "PULSE")
+            newComp = new CurrentSource(name, n1_id, n2_id, CurrentSource::SourceType::Pulse, numericParams);
+        else if (!stringParams.empty() && stringParams[0] == "PWL")
+            newComp = new CurrentSource(name, n1_id, n2_id, CurrentSource::SourceType::PWL, numericParams);
+        else if (isSinusoidal)
             newComp = new CurrentSource(name, n1_id, n2_id, CurrentSource::SourceType::Sinusoidal, numericParams[0], numericParams[1], numericParams[2]);
         else
             newComp = new CurrentSource(name, n1_id, n2_id, CurrentSource::SourceType::DC, value, 0.0, 0.0);
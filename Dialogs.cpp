@@ -34,9 +34,13 @@ SourceValueDialog::SourceValueDialog(QWidget* parent) : QDialog(parent) {
     QHBoxLayout* typeGroupBoxLayout = new QHBoxLayout();
     dcForm = new QRadioButton("DC", this);
     sinForm = new QRadioButton("Sinusoidal", this);
+    pulseForm = new QRadioButton("Pulse", this);
+    pwlForm = new QRadioButton("PWL", this);
     dcForm->setChecked(true);
     typeGroupBoxLayout->addWidget(dcForm);
     typeGroupBoxLayout->addWidget(sinForm);
+    typeGroupBoxLayout->addWidget(pulseForm);
+    typeGroupBoxLayout->addWidget(pwlForm);
     typeGroupBox->setLayout(typeGroupBoxLayout);
     layout->addWidget(typeGroupBox);
 
@@ -58,19 +62,40 @@ SourceValueDialog::SourceValueDialog(QWidget* parent) : QDialog(parent) {
     sinGroupBox->setLayout(sinFormLayout);
     layout->addWidget(sinGroupBox);
 
+    pulseGroupBox = new QGroupBox("Pulse parameters", this);
+    QFormLayout* pulseFormLayout = new QFormLayout();
+    for (const char* label : {"Initial value:", "Pulsed value:", "Delay:", "Rise time:", "Fall time:", "Pulse width:", "Period (0: single pulse):"}) {
+        QLineEdit* input = new QLineEdit(this);
+        pulseFormLayout->addRow(label, input);
+        pulseInputs.append(input);
+    }
+    pulseGroupBox->setLayout(pulseFormLayout);
+    layout->addWidget(pulseGroupBox);
+
+    pwlGroupBox = new QGroupBox("PWL parameters", this);
+    QFormLayout* pwlFormLayout = new QFormLayout();
+    pwlPoints = new QLineEdit(this);
+    pwlPoints->setPlaceholderText("t1 v1 t2 v2 ...");
+    pwlFormLayout->addRow("Points:", pwlPoints);
+    pwlGroupBox->setLayout(pwlFormLayout);
+    layout->addWidget(pwlGroupBox);
+
     buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
     layout->addWidget(buttonBox);
 
     connect(buttonBox, &QDialogButtonBox::accepted, this, &ValueDialog::accept);
     connect(buttonBox, &QDialogButtonBox::rejected, this, &ValueDialog::reject);
-    connect(sinForm, &QRadioButton::toggled, this, &SourceValueDialog::showSinOrNot);
+    for (QRadioButton* form : {dcForm, sinForm, pulseForm, pwlForm})
+        connect(form, &QRadioButton::toggled, this, &SourceValueDialog::showSourceForm);
 
-    showSinOrNot(false);
+    showSourceForm();
 }
 
-void SourceValueDialog::showSinOrNot(bool isSinusoidal) {
-    sinGroupBox->setEnabled(isSinusoidal);
-    dcGroupBox->setEnabled(!isSinusoidal);
+void SourceValueDialog::showSourceForm() {
+    dcGroupBox->setEnabled(dcForm->isChecked());
+    sinGroupBox->setEnabled(sinForm->isChecked());
+    pulseGroupBox->setEnabled(pulseForm->isChecked());
+    pwlGroupBox->setEnabled(pwlForm->isChecked());
 }
 
 
@@ -78,10 +103,26 @@ bool SourceValueDialog::isSinusoidal() const {
     return sinForm->isChecked();
 }
 
+bool SourceValueDialog::isPulse() const {
+    return pulseForm->isChecked();
+}
+
+bool SourceValueDialog::isPWL() const {
+    return pwlForm->isChecked();
+}
+
 QString SourceValueDialog::getDCValue() const { return dcInput->text(); }
 QString SourceValueDialog::getSinOffset() const { return sinOffset->text(); }
 QString SourceValueDialog::getSinAmplitude() const { return sinAmplitude->text(); }
 QString SourceValueDialog::getSinFrequency() const { return sinFrequency->text(); }
+QString SourceValueDialog::getPWLPoints() const { return pwlPoints->text(); }
+
+QStringList SourceValueDialog::getPulseParameters() const {
+    QStringList parameters;
+    for (const QLineEdit* input : pulseInputs)
+        parameters.append(input->text());
+    return parameters;
+}
 
 
 NodeLibraryDialog::NodeLibraryDialog(Circuit* circuit, QWidget* parent) : QDialog(parent) {
@@ -185,6 +226,8 @@ ConfigureAnalysisDialog::ConfigureAnalysisDialog(QWidget* parent) : QDialog(pare
     transientLayout->addRow(new QLabel("Time to start saving data:"), tStartEdit);
     transientLayout->addRow(new QLabel("Maximum Timestep:"), tStepEdit);
     transientLayout->addRow(new QLabel("Parameter (e.g. V(N_1_1), I(R1)):"), transientParameterEdit);
+    transientFromOperatingPointCheckBox = new QCheckBox("Start from the DC operating point", this);
+    transientLayout->addRow(transientFromOperatingPointCheckBox);
     tabWidget->addTab(transientTab, "Transient");
 
     // AC Sweep Tab
@@ -194,6 +237,7 @@ ConfigureAnalysisDialog::ConfigureAnalysisDialog(QWidget* parent) : QDialog(pare
     typeOfSweepComboBox->addItem("Octave");
     typeOfSweepComboBox->addItem("Decade");
     typeOfSweepComboBox->addItem("Linear");
+    typeOfSweepComboBox->addItem("Adaptive");
     ACOmegaStart = new QLineEdit(this);
     ACOmegaStop = new QLineEdit(this);
     ACNPoint = new QLineEdit(this);
@@ -221,6 +265,13 @@ ConfigureAnalysisDialog::ConfigureAnalysisDialog(QWidget* parent) : QDialog(pare
     phaseSweepTab->setEnabled(false);
     tabWidget->addTab(phaseSweepTab, "Phase Sweep");
 
+    // Operating Point Tab
+    QWidget* operatingPointTab = new QWidget(this);
+    QFormLayout* operatingPointLayout = new QFormLayout(operatingPointTab);
+    operatingPointParameterEdit = new QLineEdit(this);
+    operatingPointLayout->addRow(new QLabel("Parameter (e.g. V(N_1_1), I(R1)):"), operatingPointParameterEdit);
+    tabWidget->addTab(operatingPointTab, "Operating Point");
+
     connect(buttonBox, &QDialogButtonBox::accepted, this, &ConfigureAnalysisDialog::accept);
     connect(buttonBox, &QDialogButtonBox::rejected, this, &ConfigureAnalysisDialog::reject);
     QVBoxLayout* layout = new QVBoxLayout(this);
@@ -233,10 +284,13 @@ QString ConfigureAnalysisDialog::getTransientTstop() const {return tStopEdit->te
 QString ConfigureAnalysisDialog::getTransientTstart() const {return tStartEdit->text();}
 QString ConfigureAnalysisDialog::getTransientTstep() const {return tStepEdit->text();}
 QString ConfigureAnalysisDialog::getTransientParameter() const {return transientParameterEdit->text();}
+bool ConfigureAnalysisDialog::getTransientFromOperatingPoint() const {return transientFromOperatingPointCheckBox->isChecked();}
 QString ConfigureAnalysisDialog::getACOmegaStart() const {return ACOmegaStart->text();}
 QString ConfigureAnalysisDialog::getACOmegaStop() const {return ACOmegaStop->text();}
 QString ConfigureAnalysisDialog::getACNPoints() const {return ACNPoint->text();}
 QString ConfigureAnalysisDialog::getACParameter() const {return ACSweepParameterEdit->text();}
+QString ConfigureAnalysisDialog::getACSweepType() const {return typeOfSweepComboBox->currentText();}
+QString ConfigureAnalysisDialog::getOperatingPointParameter() const {return operatingPointParameterEdit->text();}
 
 
 SubcircuitLibarary::SubcircuitLibarary(Circuit* circuit, QWidget* parent) : QDialog(parent) {
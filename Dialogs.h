@@ -14,6 +14,7 @@
 #include <QListWidget>
 #include <QTabWidget>
 #include <QComboBox>
+#include <QCheckBox>
 #include "Circuit.h"
 
 class ValueDialog : public QDialog {
@@ -32,17 +33,23 @@ class SourceValueDialog : public QDialog {
 public:
     explicit SourceValueDialog(QWidget *parent = Q_NULLPTR);
     bool isSinusoidal() const;
+    bool isPulse() const;
+    bool isPWL() const;
     QString getDCValue() const;
     QString getSinOffset() const;
     QString getSinAmplitude() const;
     QString getSinFrequency() const;
+    QStringList getPulseParameters() const; // v1 v2 delay rise fall width period
+    QString getPWLPoints() const;
 
 private slots:
-        void showSinOrNot(bool isSin);
+        void showSourceForm();
 
 private:
     QRadioButton* dcForm;
     QRadioButton* sinForm;
+    QRadioButton* pulseForm;
+    QRadioButton* pwlForm;
 
     QGroupBox* dcGroupBox;
     QLineEdit* dcInput;
@@ -52,6 +59,12 @@ private:
     QLineEdit* sinAmplitude;
     QLineEdit* sinFrequency;
 
+    QGroupBox* pulseGroupBox;
+    QList<QLineEdit*> pulseInputs;
+
+    QGroupBox* pwlGroupBox;
+    QLineEdit* pwlPoints;
+
     QDialogButtonBox *buttonBox;
 };
 
@@ -90,14 +103,17 @@ public:
     QString getTransientTstart() const;
     QString getTransientTstep() const;
     QString getTransientParameter() const;
+    bool getTransientFromOperatingPoint() const;
     QString getACOmegaStart() const;
     QString getACOmegaStop() const;
     QString getACNPoints() const;
     QString getACParameter() const;
+    QString getACSweepType() const;
     QString getPhaseBaseFrequency() const;
     QString getPhaseStart() const;
     QString getPhaseStop() const;
     QString getPhaseNPoints() const;
+    QString getOperatingPointParameter() const;
 
 private:
     QTabWidget* tabWidget;
@@ -107,6 +123,7 @@ private:
     QLineEdit* tStartEdit;
     QLineEdit* tStepEdit;
     QLineEdit* transientParameterEdit;
+    QCheckBox* transientFromOperatingPointCheckBox;
 
     // AC Sweep
     QComboBox* typeOfSweepComboBox;
@@ -122,6 +139,9 @@ private:
     QLineEdit* phaseNPoints;
     QLineEdit* phaseParameterEdit;
 
+    // Operating Point
+    QLineEdit* operatingPointParameterEdit;
+
     QDialogButtonBox *buttonBox;
 };
 
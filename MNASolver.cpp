@@ -0,0 +1,339 @@
+#include <algorithm>
+
+#include "MNASolver.h"
+
+MNASolver::MNASolver()
+    : backend(Backend::SPARSE_LU), blockTriangularEnabled(true), usingBlocks(false), patternAnalyzed(false), factorized(false),
+      lowRankEnabled(false), maxUpdateRank(0), baseValid(false), doubleFallback(false), fallbackAnalyzed(false), preconditionerValid(false), freshIterations(-1) {}
+
+void MNASolver::setBackend(Backend newBackend, const IterativeSolverSettings& settings) {
+    iterativeSettings = settings;
+    if (newBackend != backend) {
+        backend = newBackend;
+        invalidate();
+    }
+}
+
+void MNASolver::setBlockTriangularForm(bool enabled) {
+    if (enabled != blockTriangularEnabled) {
+        blockTriangularEnabled = enabled;
+        invalidate();
+    }
+}
+
+void MNASolver::setLowRankUpdates(bool enabled, int maxRank) {
+    lowRankEnabled = enabled;
+    maxUpdateRank = maxRank;
+    baseValid = false;
+    updateColumns.clear();
+}
+
+void MNASolver::invalidate() {
+    patternAnalyzed = false;
+    factorized = false;
+    baseValid = false;
+    updateColumns.clear();
+    patternOuter.resize(0);
+    patternInner.resize(0);
+    preconditionerValid = false;
+    freshIterations = -1;
+    systemMatrix.resize(0, 0);
+    singleMatrix.resize(0, 0);
+    doubleFallback = false;
+    fallbackAnalyzed = false;
+}
+
+bool MNASolver::matchesAnalyzedPattern(const Eigen::SparseMatrix<double>& A) const {
+    if (!patternAnalyzed || !A.isCompressed())
+        return false;
+    if (patternOuter.size() != A.outerSize() + 1 || patternInner.size() != A.nonZeros())
+        return false;
+    return std::equal(patternOuter.data(), patternOuter.data() + patternOuter.size(), A.outerIndexPtr()) &&
+           std::equal(patternInner.data(), patternInner.data() + patternInner.size(), A.innerIndexPtr());
+}
+
+void MNASolver::rememberPattern(const Eigen::SparseMatrix<double>& A) {
+    patternOuter = Eigen::Map<const Eigen::VectorXi>(A.outerIndexPtr(), A.outerSize() + 1);
+    patternInner = Eigen::Map<const Eigen::VectorXi>(A.innerIndexPtr(), A.nonZeros());
+}
+
+bool MNASolver::factorize(const Eigen::SparseMatrix<double>& A) {
+    if (backend == Backend::SPARSE_LU) {
+        if (lowRankEnabled && baseValid && matchesAnalyzedPattern(A) && updateLowRank(A))
+            return true;
+        // Until A is factored there is no base: a failed factorization must not serve as one.
+        baseValid = false;
+        updateColumns.clear();
+        if (!factorizeDirect(A))
+            return false;
+        if (lowRankEnabled) {
+            baseValues.assign(A.valuePtr(), A.valuePtr() + A.nonZeros());
+            baseValid = true;
+        }
+        return true;
+    }
+    if (backend == Backend::MIXED_PRECISION_LU)
+        return factorizeMixed(A);
+
+    // The preconditioner built for an earlier matrix stays in use while it keeps the
+    // iteration count low; a new pattern always needs a new one.
+    if (!matchesAnalyzedPattern(A)) {
+        rememberPattern(A);
+        patternAnalyzed = true;
+        preconditionerValid = false;
+        fallbackAnalyzed = false;
+    }
+    systemMatrix = A;
+    doubleFallback = false;
+    factorized = preconditionerValid || buildPreconditioner();
+    return factorized;
+}
+
+bool MNASolver::factorizeDirect(const Eigen::SparseMatrix<double>& A) {
+    factorized = false;
+    if (!matchesAnalyzedPattern(A)) {
+        usingBlocks = false;
+        if (blockTriangularEnabled) {
+            if (!btf.analyze(A))
+                return false; // structurally singular
+            usingBlocks = btf.blockCount() > 1;
+        }
+        if (!usingBlocks)
+            lu.analyzePattern(A);
+        rememberPattern(A);
+        patternAnalyzed = true;
+    }
+    if (usingBlocks)
+        factorized = btf.factorize(A);
+    else {
+        lu.factorize(A);
+        factorized = (lu.info() == Eigen::Success);
+    }
+    return factorized;
+}
+
+bool MNASolver::factorizeMixed(const Eigen::SparseMatrix<double>& A) {
+    factorized = false;
+    doubleFallback = false;
+    if (!matchesAnalyzedPattern(A)) {
+        singleMatrix = A.cast<float>();
+        singleLU.analyzePattern(singleMatrix);
+        rememberPattern(A);
+        patternAnalyzed = true;
+        fallbackAnalyzed = false;
+    }
+    else
+        std::transform(A.valuePtr(), A.valuePtr() + A.nonZeros(), singleMatrix.valuePtr(), [](double v) { return static_cast<float>(v); });
+    systemMatrix = A;
+
+    singleLU.factorize(singleMatrix);
+    if (singleLU.info() != Eigen::Success) {
+        // Singular in single precision (values out of float range, or a pivot lost to rounding).
+        if (!factorizeFallback())
+            return false;
+    }
+    factorized = true;
+    return true;
+}
+
+// Double-precision LU of systemMatrix for the iterative and mixed-precision backends. The
+// symbolic analysis is kept while the pattern stays the same.
+bool MNASolver::factorizeFallback() {
+    if (!fallbackAnalyzed) {
+        lu.analyzePattern(systemMatrix);
+        fallbackAnalyzed = true;
+    }
+    lu.factorize(systemMatrix);
+    doubleFallback = (lu.info() == Eigen::Success);
+    return doubleFallback;
+}
+
+// x = LU_single^-1 b, then x += LU_single^-1 (b - A x) until the double residual meets the
+// tolerance. A step that does not halve the residual means the single-precision factors are
+// too inaccurate for this matrix, which from then on is solved with a double factorization.
+Eigen::VectorXd MNASolver::refine(const Eigen::VectorXd& b) {
+    if (doubleFallback)
+        return lu.solve(b);
+
+    const double target = iterativeSettings.tolerance * b.norm();
+    Eigen::VectorXd x = singleLU.solve(b.cast<float>()).cast<double>();
+    Eigen::VectorXd r = b - systemMatrix * x;
+    double residual = r.norm();
+    for (int step = 0; step < iterativeSettings.maxRefinementSteps && residual > target; ++step) {
+        // Normalized so that small residuals do not underflow in single precision.
+        Eigen::VectorXf correction = singleLU.solve((r / residual).cast<float>());
+        x += residual * correction.cast<double>();
+        r = b - systemMatrix * x;
+        double next = r.norm();
+        if (!(next < 0.5 * residual) && next > target) {
+            residual = next;
+            break;
+        }
+        residual = next;
+    }
+    if (residual <= target)
+        return x;
+
+    if (!factorizeFallback())
+        return Eigen::VectorXd();
+    return lu.solve(b);
+}
+
+bool MNASolver::buildPreconditioner() {
+    preconditioner.setDroptol(iterativeSettings.dropTolerance);
+    preconditioner.setFillfactor(iterativeSettings.fillFactor);
+    preconditioner.compute(systemMatrix);
+    freshIterations = -1;
+    preconditionerValid = (preconditioner.info() == Eigen::Success);
+    return preconditionerValid;
+}
+
+bool MNASolver::iterate(const Eigen::VectorXd& b, Eigen::VectorXd& x, int& iterations) {
+    Eigen::Index iters = iterativeSettings.maxIterations;
+    double error = iterativeSettings.tolerance;
+    bool converged = Eigen::internal::bicgstab(systemMatrix, b, x, preconditioner, iters, error);
+    iterations = static_cast<int>(iters);
+    return converged && error <= iterativeSettings.tolerance;
+}
+
+// Expresses A as a low-rank change of the base factorization. Returns false when the
+// change touches more than maxUpdateRank columns or the correction is ill-conditioned,
+// in which case the caller refactors A and makes it the new base.
+bool MNASolver::updateLowRank(const Eigen::SparseMatrix<double>& A) {
+    const double* values = A.valuePtr();
+    const int* outer = A.outerIndexPtr();
+    const int* inner = A.innerIndexPtr();
+    std::vector<int> columns;
+    for (int j = 0; j < A.outerSize(); ++j) {
+        for (int p = outer[j]; p < outer[j + 1]; ++p) {
+            if (values[p] != baseValues[p]) {
+                columns.push_back(j);
+                break;
+            }
+        }
+        if (static_cast<int>(columns.size()) > maxUpdateRank)
+            return false;
+    }
+
+    updateColumns = columns;
+    if (columns.empty()) {
+        factorized = true;
+        return true;
+    }
+
+    const int rank = static_cast<int>(columns.size());
+    updateW.resize(A.rows(), rank);
+    Eigen::VectorXd delta(A.rows());
+    for (int k = 0; k < rank; ++k) {
+        delta.setZero();
+        int j = columns[k];
+        for (int p = outer[j]; p < outer[j + 1]; ++p)
+            delta(inner[p]) = values[p] - baseValues[p];
+        updateW.col(k) = baseSolve(delta);
+    }
+    Eigen::MatrixXd cap = Eigen::MatrixXd::Identity(rank, rank);
+    for (int i = 0; i < rank; ++i)
+        cap.row(i) += updateW.row(columns[i]);
+    capacitance.compute(cap);
+    if (!(capacitance.rcond() > 1e-12)) {
+        updateColumns.clear();
+        return false;
+    }
+    factorized = true;
+    return true;
+}
+
+Eigen::VectorXd MNASolver::baseSolve(const Eigen::VectorXd& b) const {
+    return usingBlocks ? btf.solve(b) : Eigen::VectorXd(lu.solve(b));
+}
+
+Eigen::MatrixXd MNASolver::baseSolveColumns(const Eigen::MatrixXd& B) const {
+    return usingBlocks ? btf.solveColumns(B) : Eigen::MatrixXd(lu.solve(B));
+}
+
+// Solves for every column of B against the current factorization. The direct backend
+// substitutes all columns in one blocked pass; the iterative and mixed-precision
+// backends solve them one at a time.
+Eigen::MatrixXd MNASolver::solveColumns(const Eigen::MatrixXd& B) {
+    if (!factorized)
+        return Eigen::MatrixXd();
+    if (backend != Backend::SPARSE_LU) {
+        Eigen::MatrixXd X(B.rows(), B.cols());
+        for (Eigen::Index j = 0; j < B.cols(); ++j) {
+            Eigen::VectorXd x = solve(B.col(j));
+            if (x.size() == 0)
+                return Eigen::MatrixXd();
+            X.col(j) = x;
+        }
+        return X;
+    }
+
+    Eigen::MatrixXd Y = baseSolveColumns(B);
+    if (updateColumns.empty())
+        return Y;
+    Eigen::MatrixXd YC(updateColumns.size(), B.cols());
+    for (size_t i = 0; i < updateColumns.size(); ++i)
+        YC.row(i) = Y.row(updateColumns[i]);
+    return Y - updateW * capacitance.solve(YC);
+}
+
+Eigen::VectorXd MNASolver::solve(const Eigen::VectorXd& b, const Eigen::VectorXd& initialGuess) {
+    if (!factorized)
+        return Eigen::VectorXd();
+    if (backend == Backend::SPARSE_LU) {
+        Eigen::VectorXd y = baseSolve(b);
+        if (updateColumns.empty())
+            return y;
+        Eigen::VectorXd yC(updateColumns.size());
+        for (size_t i = 0; i < updateColumns.size(); ++i)
+            yC(i) = y(updateColumns[i]);
+        return y - updateW * capacitance.solve(yC);
+    }
+    if (backend == Backend::MIXED_PRECISION_LU)
+        return refine(b);
+    if (doubleFallback)
+        return lu.solve(b);
+
+    Eigen::VectorXd x = (initialGuess.size() == b.size()) ? initialGuess : Eigen::VectorXd::Zero(b.size());
+    Eigen::VectorXd start = x;
+    int iterations = 0;
+    bool converged = iterate(b, x, iterations);
+
+    if (converged && freshIterations < 0)
+        freshIterations = std::max(iterations, 1);
+    else if (!converged || iterations > iterativeSettings.degradationFactor * freshIterations) {
+        // The reused preconditioner no longer fits the matrix: rebuild it for the next
+        // solves and, if this one failed, retry with the fresh preconditioner.
+        if (!buildPreconditioner())
+            converged = false;
+        else if (!converged) {
+            x = start;
+            converged = iterate(b, x, iterations);
+            if (converged)
+                freshIterations = std::max(iterations, 1);
+        }
+    }
+    if (converged)
+        return x;
+
+    // Last resort: a direct factorization of this matrix, kept for its remaining solves.
+    if (!factorizeFallback())
+        return Eigen::VectorXd();
+    return lu.solve(b);
+}
+
+// Approximate minimum degree ordering of the symmetrized MNA pattern. Entry i of the
+// result is the new index of unknown i.
+Eigen::VectorXi MNASolver::fillReducingOrdering(const std::vector<Eigen::Triplet<double>>& pattern, int size) {
+    Eigen::SparseMatrix<double> structure(size, size);
+    structure.setFromTriplets(pattern.begin(), pattern.end());
+
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> eliminationOrder;
+    Eigen::AMDOrdering<int> amd;
+    amd(structure, eliminationOrder);
+
+    Eigen::VectorXi newIndex(size);
+    for (int k = 0; k < size; ++k)
+        newIndex(eliminationOrder.indices()(k)) = k;
+    return newIndex;
+}
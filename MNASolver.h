@@ -0,0 +1,111 @@
+#ifndef MNASOLVER_H
+#define MNASOLVER_H
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <Eigen/OrderingMethods>
+#include <Eigen/IterativeLinearSolvers>
+#include <vector>
+#include "BlockTriangularSolver.h"
+
+// Tuning of the BICGSTAB_ILU and MIXED_PRECISION_LU backends.
+struct IterativeSolverSettings {
+    double tolerance = 1e-10;          // relative residual
+    int maxIterations = 1000;
+    int maxRefinementSteps = 10;       // MIXED_PRECISION_LU
+    double degradationFactor = 2.0;    // rebuild the preconditioner past this many times the fresh iteration count
+    double dropTolerance = 1e-6;       // ILUT
+    int fillFactor = 10;               // ILUT
+};
+
+// -------------------------------- MNA Solver Context --------------------------------
+// Sparse LU solver that keeps the symbolic analysis (sparsity pattern, fill-reducing
+// column ordering and elimination tree) between calls. While the pattern of the MNA
+// matrix stays the same only the numeric factorization is redone.
+// The unknowns are expected to be numbered in a fill-reducing order already (see
+// fillReducingOrdering), so the LU keeps the given column order.
+//
+// The direct backend first permutes the matrix to block triangular form; when that
+// splits it into several diagonal blocks they are factored separately.
+//
+// With low-rank updates enabled the direct backend keeps its last full factorization as a
+// base. A later matrix that differs from it in at most maxUpdateRank columns is not
+// refactored; solves apply the Sherman-Morrison-Woodbury correction for the difference.
+//
+// With the BICGSTAB_ILU backend no full factorization is formed: systems are solved by
+// ILUT-preconditioned BiCGSTAB, warm-started from a caller-supplied guess. The
+// preconditioner is kept across matrix updates until the iteration count degrades.
+// A system BiCGSTAB cannot solve is factored directly, and that factorization serves
+// every further solve until the next factorize().
+//
+// The MIXED_PRECISION_LU backend factors a single-precision copy of the matrix and
+// recovers double-precision accuracy by iterative refinement against the double matrix.
+// If refinement stalls the matrix is factored in double precision instead.
+class MNASolver {
+public:
+    enum class Backend { SPARSE_LU, BICGSTAB_ILU, MIXED_PRECISION_LU };
+
+    MNASolver();
+
+    void setBackend(Backend newBackend, const IterativeSolverSettings& settings = IterativeSolverSettings());
+    Backend getBackend() const { return backend; }
+    void setBlockTriangularForm(bool enabled);
+    void setLowRankUpdates(bool enabled, int maxRank);
+
+    void invalidate();
+    bool factorize(const Eigen::SparseMatrix<double>& A);
+    Eigen::VectorXd solve(const Eigen::VectorXd& b, const Eigen::VectorXd& initialGuess = Eigen::VectorXd());
+    Eigen::MatrixXd solveColumns(const Eigen::MatrixXd& B);
+
+    bool isFactorized() const { return factorized; }
+
+    static Eigen::VectorXi fillReducingOrdering(const std::vector<Eigen::Triplet<double>>& pattern, int size);
+
+private:
+    bool matchesAnalyzedPattern(const Eigen::SparseMatrix<double>& A) const;
+    void rememberPattern(const Eigen::SparseMatrix<double>& A);
+    bool factorizeDirect(const Eigen::SparseMatrix<double>& A);
+    bool updateLowRank(const Eigen::SparseMatrix<double>& A);
+    Eigen::VectorXd baseSolve(const Eigen::VectorXd& b) const;
+    Eigen::MatrixXd baseSolveColumns(const Eigen::MatrixXd& B) const;
+    bool factorizeMixed(const Eigen::SparseMatrix<double>& A);
+    bool factorizeFallback();
+    Eigen::VectorXd refine(const Eigen::VectorXd& b);
+    bool buildPreconditioner();
+    bool iterate(const Eigen::VectorXd& b, Eigen::VectorXd& x, int& iterations);
+
+    Backend backend;
+    IterativeSolverSettings iterativeSettings;
+
+    Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::NaturalOrdering<int>> lu;
+    BlockTriangularSolver btf;
+    bool blockTriangularEnabled;
+    bool usingBlocks; // the analyzed pattern splits into several blocks; btf replaces lu
+    bool patternAnalyzed;
+    bool factorized;
+    Eigen::VectorXi patternOuter;
+    Eigen::VectorXi patternInner;
+
+    // Low-rank updates: A = A_base + dA(:, C), solved as
+    // x = y - W (I + W(C, :))^-1 y(C) with y = A_base^-1 b and W = A_base^-1 dA(:, C)
+    bool lowRankEnabled;
+    int maxUpdateRank;
+    bool baseValid;
+    std::vector<double> baseValues;
+    std::vector<int> updateColumns; // C; empty while A equals the base
+    Eigen::MatrixXd updateW;
+    Eigen::PartialPivLU<Eigen::MatrixXd> capacitance;
+
+    // Iterative and mixed-precision backends
+    Eigen::SparseMatrix<double> systemMatrix; // the double matrix being solved
+    Eigen::SparseMatrix<float> singleMatrix;
+    Eigen::SparseLU<Eigen::SparseMatrix<float>, Eigen::NaturalOrdering<int>> singleLU;
+    bool doubleFallback; // lu holds the double factorization of systemMatrix and solves with it
+    bool fallbackAnalyzed; // lu holds the symbolic analysis of the pattern of systemMatrix
+    Eigen::IncompleteLUT<double> preconditioner;
+    bool preconditionerValid;
+    int freshIterations; // iterations of the first solve after the last preconditioner build (-1: none yet)
+};
+// -------------------------------- MNA Solver Context --------------------------------
+
+#endif // MNASOLVER_H
@@ -137,6 +137,9 @@ void SchematicWidget::startOpenConfigureAnalysis() {
 
                 QMessageBox::information(this, "Info", "Transient Analysis variables updated.");
 
+                SimulationOptions options = circuit_ptr->getSimulationOptions();
+                options.transientFromOperatingPoint = dialog.getTransientFromOperatingPoint();
+                circuit_ptr->setSimulationOptions(options);
                 circuit_ptr->runTransientAnalysis(transientTStop, transientTStart, transientTStep);
                 std::map<std::string, std::map<double, double>> results = circuit_ptr->getTransientResults(paramsStr);
 
@@ -153,6 +156,14 @@ void SchematicWidget::startOpenConfigureAnalysis() {
                 acSweepStartFrequency = parseSpiceValue(dialog.getACOmegaStart().toStdString());
                 acSweepStopFrequency = parseSpiceValue(dialog.getACOmegaStop().toStdString());
                 acSweepNPoints = parseSpiceValue(dialog.getACNPoints().toStdString());
+                QString sweepTypeName = dialog.getACSweepType();
+                ACSweepType sweepType = ACSweepType::LINEAR;
+                if (sweepTypeName == "Decade")
+                    sweepType = ACSweepType::DECADE;
+                else if (sweepTypeName == "Octave")
+                    sweepType = ACSweepType::OCTAVE;
+                else if (sweepTypeName == "Adaptive")
+                    sweepType = ACSweepType::ADAPTIVE;
 
                 QString params = dialog.getACParameter();
                 std::string paramStr = params.toStdString();
@@ -173,7 +184,7 @@ void SchematicWidget::startOpenConfigureAnalysis() {
 
                 QMessageBox::information(this, "Info", "AC Sweep Analysis variables updated.");
 
-                circuit_ptr->runACAnalysis(acSweepStartFrequency, acSweepStopFrequency, acSweepNPoints);
+                circuit_ptr->runACAnalysis(acSweepStartFrequency, acSweepStopFrequency, acSweepNPoints, sweepType);
                 std::map<std::string, std::map<double, double>> results = circuit_ptr->getACSweepResults(paramsStr);
 
                 if (!results.empty()) {
@@ -185,6 +196,30 @@ void SchematicWidget::startOpenConfigureAnalysis() {
                 else
                     QMessageBox::warning(this, "Analysis Failed", "Could not generate plot data. Please check your circuit and parameters.");
             }
+            else if (dialog.getSelectedAnalysisType() == 3) {
+                QString params = dialog.getOperatingPointParameter();
+                std::string paramStr = params.toStdString();
+                std::stringstream ss(paramStr);
+                std::string word;
+                std::vector<std::string> paramsStr;
+                while (ss >> word)
+                    paramsStr.push_back(word);
+
+                if (paramsStr.empty())
+                    throw std::runtime_error("No parameters added for analysis.");
+                if (!circuit_ptr->runOperatingPointAnalysis())
+                    throw std::runtime_error("No DC operating point found.");
+
+                std::map<std::string, double> results = circuit_ptr->getOperatingPointResults(paramsStr);
+                if (!results.empty()) {
+                    QString text;
+                    for (const auto& pair : results)
+                        text += QString::fromStdString(pair.first + " = ") + QString::number(pair.second) + "\n";
+                    QMessageBox::information(this, "Operating Point", text);
+                }
+                else
+                    QMessageBox::warning(this, "Analysis Failed", "Could not find the parameters. Please check your circuit and parameters.");
+            }
         }
     } catch (const std::exception& e) {
         std::string errorMessage = e.what();
@@ -420,6 +455,24 @@ void SchematicWidget::showSourceValueDialog(QMouseEvent* event) {
             circuit_ptr->addComponent(currentCompType.toStdString(), componentName.toStdString(),
                                       node1Name.toStdString(), node2Name.toStdString(), startPoint, placementIsHorizontal, 0.0, sinParams, {}, true);
         }
+        else if (dialog.isPulse() || dialog.isPWL()) {
+            QStringList fields = dialog.isPulse()
+                                     ? dialog.getPulseParameters()
+                                     : dialog.getPWLPoints().split(QRegularExpression("[\\s,]+"), Qt::SkipEmptyParts);
+            std::vector<double> waveformParams;
+            for (const QString& field : fields) {
+                if (field.isEmpty())
+                    return;
+                waveformParams.push_back(parseSpiceValue(field.toStdString()));
+            }
+            if (waveformParams.empty())
+                return;
+
+            // The factory reads the waveform kind from stringParams[0].
+            circuit_ptr->addComponent(currentCompType.toStdString(), componentName.toStdString(),
+                                      node1Name.toStdString(), node2Name.toStdString(), startPoint, placementIsHorizontal, 0.0,
+                                      waveformParams, {dialog.isPulse() ? "PULSE" : "PWL"}, false);
+        }
         else {
             QString dcValue = dialog.getDCValue();
             if (dcValue.isEmpty())
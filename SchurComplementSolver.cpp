@@ -0,0 +1,316 @@
+#include <algorithm>
+
+#include "SchurComplementSolver.h"
+
+// Instances with more coupled unknowns than this are left in the global system; their
+// dense condensed block would cost more than it saves.
+static const int MAX_CONDENSED_PORTS = 16;
+
+SchurComplementSolver::SchurComplementSolver() : analyzed(false), factorized(false) {}
+
+void SchurComplementSolver::setInstances(std::vector<Instance> newInstances) {
+    instances = std::move(newInstances);
+    invalidate();
+}
+
+void SchurComplementSolver::invalidate() {
+    analyzed = false;
+    factorized = false;
+    blocks.clear();
+}
+
+bool SchurComplementSolver::matchesAnalyzedPattern(const Eigen::SparseMatrix<double>& A) const {
+    if (!analyzed || !A.isCompressed())
+        return false;
+    if (patternOuter.size() != A.outerSize() + 1 || patternInner.size() != A.nonZeros())
+        return false;
+    return std::equal(patternOuter.data(), patternOuter.data() + patternOuter.size(), A.outerIndexPtr()) &&
+           std::equal(patternInner.data(), patternInner.data() + patternInner.size(), A.innerIndexPtr());
+}
+
+int SchurComplementSolver::globalSlot(int row, int col) const {
+    const int* inner = global.innerIndexPtr();
+    const int* begin = inner + global.outerIndexPtr()[col];
+    const int* end = inner + global.outerIndexPtr()[col + 1];
+    return static_cast<int>(std::lower_bound(begin, end, row) - inner);
+}
+
+// -------------------------------- Symbolic phase --------------------------------
+bool SchurComplementSolver::analyze(const Eigen::SparseMatrix<double>& A) {
+    const int n = static_cast<int>(A.cols());
+    const int* outer = A.outerIndexPtr();
+    const int* inner = A.innerIndexPtr();
+    blocks.clear();
+
+    // Which instance owns each unknown; instances that overlap or couple to each other's
+    // internal unknowns are left in the global system.
+    std::vector<int> owner(n, -1);
+    std::vector<bool> valid(instances.size(), true);
+    for (size_t k = 0; k < instances.size(); ++k) {
+        valid[k] = !instances[k].internal.empty();
+        for (int i : instances[k].internal) {
+            if (i < 0 || i >= n) {
+                valid[k] = false;
+                continue;
+            }
+            if (owner[i] != -1)
+                valid[owner[i]] = valid[k] = false;
+            owner[i] = static_cast<int>(k);
+        }
+    }
+    for (int c = 0; c < n; ++c) {
+        for (int p = outer[c]; p < outer[c + 1]; ++p) {
+            int ownerRow = owner[inner[p]], ownerCol = owner[c];
+            if (ownerRow != -1 && ownerCol != -1 && ownerRow != ownerCol)
+                valid[ownerRow] = valid[ownerCol] = false;
+        }
+    }
+
+    std::vector<int> blockOf(instances.size(), -1);
+    for (size_t k = 0; k < instances.size(); ++k) {
+        if (!valid[k])
+            continue;
+        blockOf[k] = static_cast<int>(blocks.size());
+        blocks.emplace_back();
+        blocks.back().instance = instances[k];
+        blocks.back().instanceIndex = k;
+    }
+    for (int i = 0; i < n; ++i)
+        if (owner[i] != -1 && !valid[owner[i]])
+            owner[i] = -1;
+    for (int i = 0; i < n; ++i)
+        if (owner[i] != -1)
+            owner[i] = blockOf[owner[i]];
+    for (auto& block : blocks)
+        for (int port : block.instance.ports)
+            if (port >= 0 && port < n && owner[port] == -1)
+                block.ports.push_back(port);
+
+    globalIndex.assign(n, -1);
+    globalUnknown.clear();
+    for (int i = 0; i < n; ++i) {
+        if (owner[i] == -1) {
+            globalIndex[i] = static_cast<int>(globalUnknown.size());
+            globalUnknown.push_back(i);
+        }
+    }
+
+    std::vector<int> local(n, -1);
+    for (auto& block : blocks)
+        for (size_t l = 0; l < block.instance.internal.size(); ++l)
+            local[block.instance.internal[l]] = static_cast<int>(l);
+
+    // One pass over A: every entry goes to an instance block, a coupling to a port, or the
+    // global matrix. Unknowns coupled to an instance but not declared as ports are
+    // appended to its port list.
+    auto portOf = [](Block& block, int unknown) {
+        auto it = std::find(block.ports.begin(), block.ports.end(), unknown);
+        if (it != block.ports.end())
+            return static_cast<int>(it - block.ports.begin());
+        block.ports.push_back(unknown);
+        return static_cast<int>(block.ports.size()) - 1;
+    };
+    std::vector<std::vector<Eigen::Triplet<double>>> kkTriplets(blocks.size());
+    std::vector<Eigen::Triplet<double>> globalTriplets;
+    std::vector<std::pair<std::pair<int, int>, int>> globalEntries;
+    for (int c = 0; c < n; ++c) {
+        for (int p = outer[c]; p < outer[c + 1]; ++p) {
+            int r = inner[p];
+            if (owner[r] != -1 && owner[c] != -1)
+                kkTriplets[owner[r]].emplace_back(local[r], local[c], static_cast<double>(p));
+            else if (owner[r] != -1) {
+                Block& block = blocks[owner[r]];
+                block.kpEntries.push_back({local[r], portOf(block, c)});
+                block.kpSource.push_back(p);
+            }
+            else if (owner[c] != -1) {
+                Block& block = blocks[owner[c]];
+                block.pkEntries.push_back({local[c], portOf(block, r)});
+                block.pkSource.push_back(p);
+            }
+            else {
+                globalTriplets.emplace_back(globalIndex[r], globalIndex[c], 0.0);
+                globalEntries.push_back({{globalIndex[r], globalIndex[c]}, p});
+            }
+        }
+    }
+
+    // Blocks with too many ports go back to the global system: re-analyze without them.
+    bool demoted = false;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (static_cast<int>(blocks[b].ports.size()) > MAX_CONDENSED_PORTS) {
+            for (size_t k = 0; k < instances.size(); ++k)
+                if (blockOf[k] == static_cast<int>(b))
+                    instances[k].internal.clear();
+            demoted = true;
+        }
+    }
+    if (demoted)
+        return analyze(A);
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        Block& block = blocks[b];
+        for (int port : block.ports)
+            for (int port2 : block.ports)
+                globalTriplets.emplace_back(globalIndex[port], globalIndex[port2], 0.0);
+
+        int size = static_cast<int>(block.instance.internal.size());
+        block.A_kk.resize(size, size);
+        block.A_kk.setFromTriplets(kkTriplets[b].begin(), kkTriplets[b].end());
+        block.A_kk.makeCompressed();
+        block.kkSource.resize(block.A_kk.nonZeros());
+        for (Eigen::Index k = 0; k < block.A_kk.nonZeros(); ++k)
+            block.kkSource[k] = static_cast<int>(block.A_kk.valuePtr()[k]);
+        block.A_kp = Eigen::MatrixXd::Zero(size, block.ports.size());
+        block.A_pk = Eigen::MatrixXd::Zero(block.ports.size(), size);
+
+        // The first earlier block of the same definition with the same structure is the
+        // candidate whose factorization this one may reuse.
+        for (size_t other = 0; other < b && block.sharesWith == -1; ++other) {
+            const Block& candidate = blocks[other];
+            if (candidate.sharesWith != -1 || candidate.instance.definition != block.instance.definition)
+                continue;
+            if (candidate.A_kk.nonZeros() != block.A_kk.nonZeros() || candidate.A_kk.rows() != block.A_kk.rows() ||
+                candidate.ports.size() != block.ports.size() ||
+                candidate.kpEntries != block.kpEntries || candidate.pkEntries != block.pkEntries)
+                continue;
+            if (std::equal(candidate.A_kk.outerIndexPtr(), candidate.A_kk.outerIndexPtr() + size + 1, block.A_kk.outerIndexPtr()) &&
+                std::equal(candidate.A_kk.innerIndexPtr(), candidate.A_kk.innerIndexPtr() + block.A_kk.nonZeros(), block.A_kk.innerIndexPtr()))
+                block.sharesWith = static_cast<int>(other);
+        }
+    }
+
+    int globalSize = static_cast<int>(globalUnknown.size());
+    global.resize(globalSize, globalSize);
+    global.setFromTriplets(globalTriplets.begin(), globalTriplets.end());
+    global.makeCompressed();
+    globalSource.clear();
+    for (const auto& entry : globalEntries)
+        globalSource.push_back({globalSlot(entry.first.first, entry.first.second), entry.second});
+    for (auto& block : blocks) {
+        block.condensedSlots.clear();
+        for (int port2 : block.ports)
+            for (int port : block.ports)
+                block.condensedSlots.push_back(globalSlot(globalIndex[port], globalIndex[port2]));
+    }
+    if (globalSize > 0)
+        globalLU.analyzePattern(global);
+
+    patternOuter = Eigen::Map<const Eigen::VectorXi>(A.outerIndexPtr(), A.outerSize() + 1);
+    patternInner = Eigen::Map<const Eigen::VectorXi>(A.innerIndexPtr(), A.nonZeros());
+    analyzed = true;
+    return true;
+}
+// -------------------------------- Symbolic phase --------------------------------
+
+
+// -------------------------------- Numeric phase --------------------------------
+bool SchurComplementSolver::factorize(const Eigen::SparseMatrix<double>& A) {
+    factorized = false;
+    if (!matchesAnalyzedPattern(A) && !analyze(A))
+        return false;
+
+    const double* a = A.valuePtr();
+    for (auto& block : blocks) {
+        block.values.clear();
+        for (int source : block.kkSource)
+            block.values.push_back(a[source]);
+        for (int source : block.kpSource)
+            block.values.push_back(a[source]);
+        for (int source : block.pkSource)
+            block.values.push_back(a[source]);
+
+        block.A_kp.setZero();
+        block.A_pk.setZero();
+        for (size_t k = 0; k < block.kpEntries.size(); ++k)
+            block.A_kp(block.kpEntries[k].first, block.kpEntries[k].second) += a[block.kpSource[k]];
+        for (size_t k = 0; k < block.pkEntries.size(); ++k)
+            block.A_pk(block.pkEntries[k].second, block.pkEntries[k].first) += a[block.pkSource[k]];
+
+        if (block.sharesWith != -1 && blocks[block.sharesWith].values == block.values) {
+            const Block& shared = blocks[block.sharesWith];
+            block.lu = shared.lu;
+            block.Z = shared.Z;
+            block.condensed = shared.condensed;
+            continue;
+        }
+
+        if (!block.lu || (block.sharesWith != -1 && block.lu == blocks[block.sharesWith].lu)) {
+            block.lu = std::make_shared<LU>();
+            block.lu->analyzePattern(block.A_kk);
+        }
+        std::copy(block.values.begin(), block.values.begin() + block.kkSource.size(), block.A_kk.valuePtr());
+        block.lu->factorize(block.A_kk);
+        // A_kk can be singular on its own while A is not, e.g. with a voltage source right
+        // across two ports: the instance goes back to the global system.
+        if (block.lu->info() != Eigen::Success) {
+            instances[block.instanceIndex].internal.clear();
+            analyzed = false;
+            return factorize(A);
+        }
+        block.Z = block.lu->solve(block.A_kp);
+        block.condensed = block.A_pk * block.Z;
+    }
+
+    if (global.rows() > 0) {
+        double* g = global.valuePtr();
+        std::fill(g, g + global.nonZeros(), 0.0);
+        for (const auto& source : globalSource)
+            g[source.first] += a[source.second];
+        for (const auto& block : blocks)
+            for (size_t k = 0; k < block.condensedSlots.size(); ++k)
+                g[block.condensedSlots[k]] -= block.condensed.data()[k];
+        globalLU.factorize(global);
+        if (globalLU.info() != Eigen::Success)
+            return false;
+    }
+    factorized = true;
+    return true;
+}
+
+Eigen::VectorXd SchurComplementSolver::solve(const Eigen::VectorXd& b) const {
+    return solveColumns(b);
+}
+
+// Every step works on all columns of B at once.
+Eigen::MatrixXd SchurComplementSolver::solveColumns(const Eigen::MatrixXd& B) const {
+    if (!factorized)
+        return Eigen::MatrixXd();
+
+    Eigen::MatrixXd reduced(globalUnknown.size(), B.cols());
+    for (size_t g = 0; g < globalUnknown.size(); ++g)
+        reduced.row(g) = B.row(globalUnknown[g]);
+
+    // y_k = A_kk^-1 b_k; the ports see b_p - A_pk y_k
+    std::vector<Eigen::MatrixXd> local(blocks.size());
+    for (size_t k = 0; k < blocks.size(); ++k) {
+        const Block& block = blocks[k];
+        Eigen::MatrixXd b_k(block.instance.internal.size(), B.cols());
+        for (size_t l = 0; l < block.instance.internal.size(); ++l)
+            b_k.row(l) = B.row(block.instance.internal[l]);
+        local[k] = block.lu->solve(b_k);
+        Eigen::MatrixXd portShift = block.A_pk * local[k];
+        for (size_t p = 0; p < block.ports.size(); ++p)
+            reduced.row(globalIndex[block.ports[p]]) -= portShift.row(p);
+    }
+
+    Eigen::MatrixXd X(B.rows(), B.cols());
+    if (reduced.rows() > 0) {
+        Eigen::MatrixXd reducedSolution = globalLU.solve(reduced);
+        for (size_t g = 0; g < globalUnknown.size(); ++g)
+            X.row(globalUnknown[g]) = reducedSolution.row(g);
+    }
+
+    // x_k = A_kk^-1 (b_k - A_kp x_p) = y_k - Z_k x_p
+    for (size_t k = 0; k < blocks.size(); ++k) {
+        const Block& block = blocks[k];
+        Eigen::MatrixXd x_p(block.ports.size(), B.cols());
+        for (size_t p = 0; p < block.ports.size(); ++p)
+            x_p.row(p) = X.row(block.ports[p]);
+        Eigen::MatrixXd x_k = local[k] - block.Z * x_p;
+        for (size_t l = 0; l < block.instance.internal.size(); ++l)
+            X.row(block.instance.internal[l]) = x_k.row(l);
+    }
+    return X;
+}
+// -------------------------------- Numeric phase --------------------------------
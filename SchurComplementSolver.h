@@ -0,0 +1,73 @@
+#ifndef SCHURCOMPLEMENTSOLVER_H
+#define SCHURCOMPLEMENTSOLVER_H
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -------------------------------- Schur Complement Solver --------------------------------
+// Solves the MNA system with the unknowns of every subcircuit instance condensed onto the
+// instance's ports. Each instance block A_kk is factored on its own and contributes
+// -A_pk A_kk^-1 A_kp to the global (top-level plus port) system, which is the only one
+// factored as a whole. Instances of the same definition whose stamps are identical share
+// one factorization and one condensed block.
+class SchurComplementSolver {
+public:
+    struct Instance {
+        std::string definition;  // instances are only compared within a definition
+        std::vector<int> internal; // MNA indices, in the same local order for every instance of a definition
+        std::vector<int> ports;    // MNA indices of the port nodes (ground excluded), in port order
+    };
+
+    SchurComplementSolver();
+
+    void setInstances(std::vector<Instance> newInstances);
+    void invalidate();
+    bool factorize(const Eigen::SparseMatrix<double>& A);
+    Eigen::VectorXd solve(const Eigen::VectorXd& b) const;
+    Eigen::MatrixXd solveColumns(const Eigen::MatrixXd& B) const; // one solve per column of B
+
+    bool isFactorized() const { return factorized; }
+
+private:
+    using LU = Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::NaturalOrdering<int>>;
+
+    struct Block {
+        Instance instance;
+        size_t instanceIndex;   // into instances
+        std::vector<int> ports; // all global unknowns the block couples to, declared ports first
+        Eigen::SparseMatrix<double> A_kk;
+        std::vector<int> kkSource;               // A value index per nonzero of A_kk
+        std::vector<std::pair<int, int>> kpEntries, pkEntries; // (local row/col, port) ...
+        std::vector<int> kpSource, pkSource;     // ... and their A value indices
+        std::vector<double> values;              // gathered values of A_kk, A_kp, A_pk
+        std::shared_ptr<LU> lu;
+        Eigen::MatrixXd A_kp, A_pk;
+        Eigen::MatrixXd Z;                       // A_kk^-1 A_kp
+        Eigen::MatrixXd condensed;               // A_pk Z
+        std::vector<int> condensedSlots;         // value slots in the global matrix, column-major p x p
+        int sharesWith = -1;                     // block whose factorization is reused
+    };
+
+    bool analyze(const Eigen::SparseMatrix<double>& A);
+    bool matchesAnalyzedPattern(const Eigen::SparseMatrix<double>& A) const;
+    int globalSlot(int row, int col) const;
+
+    std::vector<Instance> instances;
+    std::vector<Block> blocks;
+    std::vector<int> globalIndex;   // MNA index -> index in the global system, -1 if condensed
+    std::vector<int> globalUnknown; // inverse of globalIndex
+    Eigen::SparseMatrix<double> global;
+    std::vector<std::pair<int, int>> globalSource; // (global value slot, A value index)
+    LU globalLU;
+
+    bool analyzed;
+    bool factorized;
+    Eigen::VectorXi patternOuter;
+    Eigen::VectorXi patternInner;
+};
+// -------------------------------- Schur Complement Solver --------------------------------
+
+#endif // SCHURCOMPLEMENTSOLVER_H
@@ -0,0 +1,210 @@
+#include <algorithm>
+
+#include "StampEngine.h"
+
+StampEngine::StampEngine()
+    : built(false), size(0), trashSlot(0),
+      resistors({1.0, 1.0, -1.0, -1.0}), capacitors({1.0, 1.0, -1.0, -1.0}),
+      incidences({1.0, 1.0, -1.0, -1.0}), inductors({-1.0}),
+      stepValuesValid(false), targetStale(true), stampedStep(0.0), stampedAlpha(1.0) {}
+
+void StampEngine::invalidate() {
+    built = false;
+    stepValuesValid = false;
+}
+
+// -------------------------------- Batch construction --------------------------------
+void StampEngine::build(const std::vector<std::shared_ptr<Component>>& components, int matrixSize, double time, double h) {
+    size = matrixSize;
+    resistors.clear();
+    capacitors.clear();
+    incidences.clear();
+    inductors.clear();
+    staticDevices.clear();
+    stepDevices.clear();
+    varyingDevices.clear();
+
+    auto conductance = [](int a, int b) {
+        return std::array<std::pair<int, int>, 4>{{{a, a}, {b, b}, {a, b}, {b, a}}};
+    };
+    auto incidence = [](int a, int b, int branch) {
+        return std::array<std::pair<int, int>, 4>{{{a, branch}, {branch, a}, {b, branch}, {branch, b}}};
+    };
+
+    for (const auto& comp : components) {
+        switch (comp->type) {
+        case Component::Type::RESISTOR:
+            resistors.positions.push_back(conductance(comp->n1Index, comp->n2Index));
+            resistors.coeff.push_back(1.0 / comp->value);
+            continue;
+        case Component::Type::CAPACITOR:
+            capacitors.positions.push_back(conductance(comp->n1Index, comp->n2Index));
+            capacitors.coeff.push_back(comp->value);
+            continue;
+        case Component::Type::INDUCTOR:
+            if (comp->branchIndex == -1)
+                break;
+            incidences.positions.push_back(incidence(comp->n1Index, comp->n2Index, comp->branchIndex));
+            incidences.coeff.push_back(1.0);
+            inductors.positions.push_back({{{comp->branchIndex, comp->branchIndex}}});
+            inductors.coeff.push_back(comp->value);
+            continue;
+        case Component::Type::VOLTAGE_SOURCE:
+        case Component::Type::AC_VOLTAGE_SOURCE:
+            if (comp->branchIndex == -1)
+                break;
+            incidences.positions.push_back(incidence(comp->n1Index, comp->n2Index, comp->branchIndex));
+            incidences.coeff.push_back(1.0);
+            continue;
+        default:
+            break;
+        }
+
+        int deps = comp->matrixDependencies();
+        if (deps & (Component::DEPENDS_ON_TIME | Component::DEPENDS_ON_ITERATE))
+            varyingDevices.push_back(comp);
+        else if (deps & Component::DEPENDS_ON_STEP)
+            stepDevices.push_back(comp);
+        else
+            staticDevices.push_back(comp);
+    }
+
+    buildPattern(time, h);
+    built = true;
+}
+
+template<int N>
+void StampEngine::collectBatch(MNATriplets& triplets, const Batch<N>& batch) const {
+    for (const auto& device : batch.positions)
+        for (const auto& entry : device)
+            if (entry.first != -1 && entry.second != -1)
+                triplets.emplace_back(entry.first, entry.second, 0.0);
+}
+
+template<int N>
+void StampEngine::resolveSlots(Batch<N>& batch) {
+    batch.slots.resize(N * batch.positions.size());
+    for (size_t k = 0; k < batch.positions.size(); ++k)
+        for (int j = 0; j < N; ++j)
+            batch.slots[N * k + j] = slotOf(batch.positions[k][j].first, batch.positions[k][j].second);
+}
+
+// The pattern is the union of all batched positions and of whatever the generic devices
+// stamp right now; explicit zeros are kept so that the structure never changes.
+void StampEngine::buildPattern(double time, double h) {
+    MNATriplets triplets;
+    collectBatch(triplets, resistors);
+    collectBatch(triplets, capacitors);
+    collectBatch(triplets, incidences);
+    collectBatch(triplets, inductors);
+    for (const auto* group : {&staticDevices, &stepDevices, &varyingDevices})
+        for (const auto& comp : *group)
+            comp->stampMatrix(triplets, time, h);
+    for (auto& t : triplets)
+        t = Eigen::Triplet<double>(t.row(), t.col(), 0.0);
+
+    pattern.resize(size, size);
+    pattern.setFromTriplets(triplets.begin(), triplets.end());
+    pattern.makeCompressed();
+    trashSlot = pattern.nonZeros();
+
+    resolveSlots(resistors);
+    resolveSlots(capacitors);
+    resolveSlots(incidences);
+    resolveSlots(inductors);
+
+    staticValues.assign(trashSlot + 1, 0.0);
+    scatter(staticValues, resistors, 1.0);
+    scatter(staticValues, incidences, 1.0);
+    scatterGeneric(staticValues, staticDevices, time, h);
+    stepValuesValid = false;
+}
+
+int StampEngine::slotOf(int row, int col) const {
+    if (row == -1 || col == -1)
+        return trashSlot;
+    const int* inner = pattern.innerIndexPtr();
+    const int* begin = inner + pattern.outerIndexPtr()[col];
+    const int* end = inner + pattern.outerIndexPtr()[col + 1];
+    const int* it = std::lower_bound(begin, end, row);
+    if (it == end || *it != row)
+        return -1;
+    return static_cast<int>(it - inner);
+}
+// -------------------------------- Batch construction --------------------------------
+
+
+// -------------------------------- Assembly --------------------------------
+template<int N>
+void StampEngine::scatter(std::vector<double>& values, const Batch<N>& batch, double scale) {
+    double* v = values.data();
+    const int* slot = batch.slots.data();
+    const double* coeff = batch.coeff.data();
+    const size_t count = batch.coeff.size();
+    for (size_t k = 0; k < count; ++k, slot += N) {
+        const double c = scale * coeff[k];
+        for (int j = 0; j < N; ++j)
+            v[slot[j]] += batch.signs[j] * c;
+    }
+}
+
+bool StampEngine::scatterGeneric(std::vector<double>& values, const std::vector<std::shared_ptr<Component>>& devices, double time, double h) {
+    genericStamps.clear();
+    for (const auto& comp : devices)
+        comp->stampMatrix(genericStamps, time, h);
+    for (const auto& t : genericStamps) {
+        int slot = slotOf(t.row(), t.col());
+        if (slot == -1)
+            return false;
+        values[slot] += t.value();
+    }
+    return true;
+}
+
+// Copies the pattern into A so that assemble() can write its value array directly.
+void StampEngine::attach(Eigen::SparseMatrix<double>& A) {
+    A = pattern;
+    targetStale = true;
+}
+
+// Writes the current matrix values into A (which must carry the engine's pattern, see
+// attach()). Returns false if nothing changed since the previous call.
+bool StampEngine::assemble(Eigen::SparseMatrix<double>& A, double time, double h, double alpha) {
+    bool changed = false;
+    if (!stepValuesValid || h != stampedStep || alpha != stampedAlpha) {
+        stepValues = staticValues;
+        if (h != 0.0) {
+            scatter(stepValues, capacitors, alpha / h);
+            scatter(stepValues, inductors, alpha / h);
+        }
+        if (!scatterGeneric(stepValues, stepDevices, time, h)) {
+            buildPattern(time, h);
+            attach(A);
+            return assemble(A, time, h, alpha);
+        }
+        stampedStep = h;
+        stampedAlpha = alpha;
+        stepValuesValid = true;
+        changed = true;
+    }
+
+    const std::vector<double>* values = &stepValues;
+    if (!varyingDevices.empty()) {
+        workValues = stepValues;
+        if (!scatterGeneric(workValues, varyingDevices, time, h)) {
+            buildPattern(time, h);
+            attach(A);
+            return assemble(A, time, h, alpha);
+        }
+        values = &workValues;
+        changed = true;
+    }
+
+    if (targetStale)
+        changed = true;
+    targetStale = false;
+    if (changed)
+        std::copy(values->begin(), values->begin() + trashSlot, A.valuePtr());
+    return changed;
+}
+// -------------------------------- Assembly --------------------------------
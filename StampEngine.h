@@ -0,0 +1,76 @@
+#ifndef STAMPENGINE_H
+#define STAMPENGINE_H
+
+#include <Eigen/Sparse>
+#include <array>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "Component.h"
+
+// -------------------------------- Stamp Engine --------------------------------
+// Assembles the transient MNA matrix without a virtual call per device. Devices are
+// grouped by Component::Type into structure-of-arrays batches holding, for every stamp,
+// its position in the value array of the compressed matrix. Ground terminals point at a
+// trailing scratch slot, so each batch is stamped by a straight indexed loop.
+// Types without a batch (diodes, current-controlled sources, ...) still go through
+// their virtual stampMatrix and are scattered into the same value array.
+class StampEngine {
+public:
+    StampEngine();
+
+    void build(const std::vector<std::shared_ptr<Component>>& components, int size, double time, double h);
+    void attach(Eigen::SparseMatrix<double>& A);
+    // alpha is the leading coefficient of the integration formula (see IntegrationStep).
+    bool assemble(Eigen::SparseMatrix<double>& A, double time, double h, double alpha = 1.0);
+    void invalidate();
+    bool isBuilt() const { return built; }
+
+private:
+    // N stamps per device; stamp j adds signs[j] * scale * coeff[device] to its slot.
+    template<int N>
+    struct Batch {
+        std::array<double, N> signs;
+        std::vector<std::array<std::pair<int, int>, N>> positions;
+        std::vector<int> slots;
+        std::vector<double> coeff;
+
+        explicit Batch(const std::array<double, N>& s) : signs(s) {}
+        void clear() { positions.clear(); slots.clear(); coeff.clear(); }
+    };
+
+    template<int N>
+    static void scatter(std::vector<double>& values, const Batch<N>& batch, double scale);
+    template<int N>
+    void collectBatch(MNATriplets& triplets, const Batch<N>& batch) const;
+    template<int N>
+    void resolveSlots(Batch<N>& batch);
+
+    int slotOf(int row, int col) const;
+    void buildPattern(double time, double h);
+    bool scatterGeneric(std::vector<double>& values, const std::vector<std::shared_ptr<Component>>& devices, double time, double h);
+
+    bool built;
+    int size;
+    int trashSlot;
+    Eigen::SparseMatrix<double> pattern;
+
+    Batch<4> resistors;   // conductance 1/R
+    Batch<4> capacitors;  // C, scaled by alpha/h
+    Batch<4> incidences;  // branch incidence of inductors and voltage sources
+    Batch<1> inductors;   // -L on the branch diagonal, scaled by alpha/h
+
+    std::vector<std::shared_ptr<Component>> staticDevices, stepDevices, varyingDevices;
+    MNATriplets genericStamps;
+
+    std::vector<double> staticValues;
+    std::vector<double> stepValues;
+    std::vector<double> workValues;
+    bool stepValuesValid;
+    bool targetStale; // the attached matrix holds no values yet
+    double stampedStep;
+    double stampedAlpha;
+};
+// -------------------------------- Stamp Engine --------------------------------
+
+#endif // STAMPENGINE_H
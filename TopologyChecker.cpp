@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <numeric>
+#include <queue>
+
+#include "TopologyChecker.h"
+#include "BlockTriangularSolver.h"
+
+namespace {
+
+// How a device's own branch (not its controlling port) behaves in the graph checks.
+enum class BranchKind { CURRENT, CAPACITIVE, CONDUCTIVE, INDUCTIVE, VOLTAGE };
+
+BranchKind branchKind(Component::Type type) {
+    switch (type) {
+    case Component::Type::CURRENT_SOURCE:
+    case Component::Type::VCCS:
+    case Component::Type::CCCS:
+        return BranchKind::CURRENT;
+    case Component::Type::CAPACITOR:
+        return BranchKind::CAPACITIVE;
+    case Component::Type::INDUCTOR:
+        return BranchKind::INDUCTIVE;
+    case Component::Type::VOLTAGE_SOURCE:
+    case Component::Type::AC_VOLTAGE_SOURCE:
+    case Component::Type::VCVS:
+    case Component::Type::CCVS:
+        return BranchKind::VOLTAGE;
+    default:
+        return BranchKind::CONDUCTIVE;
+    }
+}
+
+struct DisjointSets {
+    std::vector<int> parent;
+    explicit DisjointSets(int n) : parent(n) { std::iota(parent.begin(), parent.end(), 0); }
+    int find(int x) {
+        while (parent[x] != x)
+            x = parent[x] = parent[parent[x]];
+        return x;
+    }
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+            return false;
+        parent[a] = b;
+        return true;
+    }
+};
+
+std::string joinNames(const std::vector<std::string>& names) {
+    std::string joined;
+    for (const auto& name : names)
+        joined += (joined.empty() ? "" : ", ") + name;
+    return "{" + joined + "}";
+}
+
+} // namespace
+
+TopologyChecker::Report TopologyChecker::check(const std::vector<std::shared_ptr<Component>>& components, const std::map<int, std::string>& nodeNames) {
+    // Dense vertex numbering: 0 is ground, every other node follows in id order.
+    std::map<int, int> vertexOf;
+    std::vector<std::string> vertexNames = {"ground"};
+    for (const auto& pair : nodeNames) {
+        vertexOf[pair.first] = static_cast<int>(vertexNames.size());
+        vertexNames.push_back(pair.second);
+    }
+    auto vertex = [&](int nodeId) {
+        auto it = vertexOf.find(nodeId);
+        return it == vertexOf.end() ? 0 : it->second;
+    };
+    const int n = static_cast<int>(vertexNames.size());
+
+    struct Branch { int a, b; BranchKind kind; const std::string* name; };
+    std::vector<Branch> branches;
+    for (const auto& comp : components)
+        branches.push_back({vertex(comp->node1), vertex(comp->node2), branchKind(comp->type), &comp->name});
+
+    Report report;
+
+    // ---------------- Connectivity ----------------
+    // Capacitors conduct in transient and AC analyses but not at DC.
+    DisjointSets connected(n), connectedDC(n);
+    for (const auto& branch : branches) {
+        if (branch.kind == BranchKind::CURRENT)
+            continue;
+        connected.unite(branch.a, branch.b);
+        if (branch.kind != BranchKind::CAPACITIVE)
+            connectedDC.unite(branch.a, branch.b);
+    }
+
+    std::map<int, std::vector<int>> floating, floatingDC;
+    for (int v = 1; v < n; ++v) {
+        if (connected.find(v) != connected.find(0))
+            floating[connected.find(v)].push_back(v);
+        else if (connectedDC.find(v) != connectedDC.find(0))
+            floatingDC[connectedDC.find(v)].push_back(v);
+    }
+
+    for (const auto& [root, vertices] : floating) {
+        std::vector<std::string> nodes, sources;
+        for (int v : vertices)
+            nodes.push_back(vertexNames[v]);
+        for (const auto& branch : branches) {
+            if (branch.kind == BranchKind::CURRENT && (connected.find(branch.a) == root) != (connected.find(branch.b) == root))
+                sources.push_back(*branch.name);
+        }
+        if (sources.empty())
+            report.errors.push_back("Nodes " + joinNames(nodes) + " are floating: no device connects them to ground.");
+        else
+            report.errors.push_back("Nodes " + joinNames(nodes) + " are connected to the rest of the circuit only through current sources " + joinNames(sources) + ".");
+    }
+    for (const auto& [root, vertices] : floatingDC) {
+        std::vector<std::string> nodes;
+        for (int v : vertices)
+            nodes.push_back(vertexNames[v]);
+        report.dcErrors.push_back("Nodes " + joinNames(nodes) + " have no DC path to ground, only capacitors.");
+    }
+    // ---------------- Connectivity ----------------
+
+    // ---------------- Voltage loops ----------------
+    // A spanning forest of the voltage-defining branches; a branch that closes a cycle
+    // names the loop through the forest path between its ends. Inductors join in a
+    // second pass, so a loop found then contains at least one of them.
+    DisjointSets forest(n);
+    std::vector<std::vector<std::pair<int, int>>> tree(n); // (neighbour, branch)
+    auto treePath = [&](int from, int to) {
+        std::vector<int> previousBranch(n, -1), previousVertex(n, -1);
+        std::queue<int> queue;
+        queue.push(from);
+        previousVertex[from] = from;
+        while (!queue.empty() && previousVertex[to] == -1) {
+            int v = queue.front();
+            queue.pop();
+            for (const auto& [w, branch] : tree[v]) {
+                if (previousVertex[w] == -1) {
+                    previousVertex[w] = v;
+                    previousBranch[w] = branch;
+                    queue.push(w);
+                }
+            }
+        }
+        std::vector<std::string> names;
+        for (int v = to; v != from; v = previousVertex[v])
+            names.push_back(*branches[previousBranch[v]].name);
+        return names;
+    };
+
+    for (BranchKind pass : {BranchKind::VOLTAGE, BranchKind::INDUCTIVE}) {
+        for (int i = 0; i < static_cast<int>(branches.size()); ++i) {
+            const Branch& branch = branches[i];
+            if (branch.kind != pass)
+                continue;
+            if (forest.unite(branch.a, branch.b)) {
+                tree[branch.a].push_back({branch.b, i});
+                tree[branch.b].push_back({branch.a, i});
+                continue;
+            }
+            std::vector<std::string> loop = treePath(branch.a, branch.b);
+            loop.insert(loop.begin(), *branch.name);
+            if (pass == BranchKind::VOLTAGE)
+                report.errors.push_back("Voltage sources " + joinNames(loop) + " form a loop.");
+            else
+                report.dcErrors.push_back("Inductors and voltage sources " + joinNames(loop) + " form a loop, which is a short circuit at DC.");
+        }
+    }
+    // ---------------- Voltage loops ----------------
+
+    return report;
+}
+
+std::vector<int> TopologyChecker::structurallySingular(const MNATriplets& pattern, int size) {
+    Eigen::SparseMatrix<double> A(size, size);
+    A.setFromTriplets(pattern.begin(), pattern.end());
+
+    std::vector<int> matchedRow, unmatched;
+    if (BlockTriangularSolver::maximumTransversal(A, matchedRow) == size)
+        return unmatched;
+    for (int j = 0; j < size; ++j) {
+        if (matchedRow[j] == -1)
+            unmatched.push_back(j);
+    }
+    return unmatched;
+}
@@ -0,0 +1,38 @@
+#ifndef TOPOLOGYCHECKER_H
+#define TOPOLOGYCHECKER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Component.h"
+
+// -------------------------------- Topology Checker --------------------------------
+// Graph checks run once per compiled topology, so that circuits whose MNA matrix is
+// singular are rejected by name before any analysis runs:
+//  - node groups with no connection to ground at all (floating), or connected to the
+//    rest of the circuit only through current sources (a current-source cutset);
+//  - loops made of voltage sources (independent, AC, VCVS, CCVS);
+//  - node groups that reach ground only through capacitors, and loops that also contain
+//    inductors. These are only singular at DC, where capacitors are open and inductors
+//    shorted, and are kept apart as dcErrors.
+// structurallySingular() finds the unknowns left without a pivot by a maximum transversal
+// of the stamped pattern, which catches whatever the graph rules miss.
+class TopologyChecker {
+public:
+    struct Report {
+        std::vector<std::string> errors;
+        std::vector<std::string> dcErrors;
+        // DC analyses (the operating point and the bias point of an AC sweep) also fail on
+        // dcErrors; a transient run from zero initial conditions never solves the DC system.
+        bool ok(bool dc = false) const { return errors.empty() && (!dc || dcErrors.empty()); }
+    };
+
+    // nodeNames holds every node that carries an MNA unknown; any other node id is ground.
+    static Report check(const std::vector<std::shared_ptr<Component>>& components, const std::map<int, std::string>& nodeNames);
+    // MNA indices of the columns without a match (empty when A has full structural rank).
+    static std::vector<int> structurallySingular(const MNATriplets& pattern, int size);
+};
+// -------------------------------- Topology Checker --------------------------------
+
+#endif // TOPOLOGYCHECKER_H
@@ -0,0 +1,139 @@
+#include <cmath>
+#include "TestSupport.h"
+
+// -------------------------------- DC operating point --------------------------------
+// Diode model used by the checks below: I = Is (exp(V / Vt) - 1).
+static const double diodeIs = 1e-12, diodeVt = 0.026;
+
+// 20 V through 100 ohm into two diodes in series, the lower one shunted by 1 k. The
+// capacitor is open at DC.
+static void buildDiodeStack(Circuit& circuit, const SimulationOptions& options) {
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 20.0);
+    addElement(circuit, "R", "R1", "in", "a", 100.0);
+    addElement(circuit, "D", "D1", "a", "b", 0.0);
+    addElement(circuit, "D", "D2", "b", "0", 0.0);
+    addElement(circuit, "R", "R2", "b", "0", 1e3);
+    addElement(circuit, "C", "C1", "a", "0", 1e-6);
+    circuit.setSimulationOptions(options);
+}
+
+TEST_CASE(operatingPointSolvesDiodeStack) {
+    Circuit circuit;
+    buildDiodeStack(circuit, SimulationOptions());
+    CHECK(circuit.runOperatingPointAnalysis());
+    CHECK(circuit.getAnalysisStats().homotopyStages == 0);
+    auto op = circuit.getOperatingPointResults({"V(a)", "V(b)", "I(R1)"});
+    const double Va = op["V(a)"], Vb = op["V(b)"];
+    CHECK_NEAR(Vb, 0.6747, 1e-3);
+    // Kirchhoff's current law at both nodes, to the Newton tolerance.
+    const double current = (20.0 - Va) / 100.0;
+    CHECK_NEAR(op["I(R1)"], current, 1e-9);
+    CHECK_NEAR(diodeIs * (std::exp((Va - Vb) / diodeVt) - 1.0), current, 1e-3 * current);
+    CHECK_NEAR(diodeIs * (std::exp(Vb / diodeVt) - 1.0) + Vb / 1e3, current, 1e-3 * current);
+}
+
+// With Newton capped at four iterations the diode stack cannot be solved from zero; the
+// source ramp reaches the same point through many easy stages.
+TEST_CASE(sourceSteppingSolvesWhatNewtonCannot) {
+    Circuit reference;
+    buildDiodeStack(reference, SimulationOptions());
+    CHECK(reference.runOperatingPointAnalysis());
+    const double expected = reference.getOperatingPointResults({"V(a)"})["V(a)"];
+
+    SimulationOptions options;
+    options.newtonMaxIterations = 4;
+    options.gminStepping = false;
+    options.sourceStepping = false;
+    Circuit plain;
+    buildDiodeStack(plain, options);
+    CHECK(!plain.runOperatingPointAnalysis());
+
+    options.sourceStepping = true;
+    Circuit stepped;
+    buildDiodeStack(stepped, options);
+    CHECK(stepped.runOperatingPointAnalysis());
+    CHECK(stepped.getAnalysisStats().homotopyStages > 0);
+    CHECK_NEAR(stepped.getOperatingPointResults({"V(a)"})["V(a)"], expected, 1e-4);
+}
+
+// Without the topology check the node shunts would carry a current source through a
+// capacitor at 1e9 V, and an inductor across a voltage source leaves a singular system.
+TEST_CASE(operatingPointRejectsDCTopologyErrors) {
+    Circuit chargedNode;
+    chargedNode.addGround("0", QPoint());
+    addElement(chargedNode, "I", "I1", "0", "a", 1e-3);
+    addElement(chargedNode, "C", "C1", "a", "0", 1e-6);
+    CHECK(!chargedNode.runOperatingPointAnalysis());
+
+    Circuit shortedSource;
+    shortedSource.addGround("0", QPoint());
+    addElement(shortedSource, "V", "V1", "a", "0", 1.0);
+    addElement(shortedSource, "L", "L1", "a", "0", 1e-3);
+    addElement(shortedSource, "R", "R1", "a", "0", 1e3);
+    CHECK(!shortedSource.runOperatingPointAnalysis());
+
+    // A transient from the operating point fails on them as well; one from zero runs.
+    SimulationOptions options;
+    options.transientFromOperatingPoint = true;
+    chargedNode.setSimulationOptions(options);
+    chargedNode.runTransientAnalysis(1e-3, 0.0, 1e-4);
+    CHECK(waveform(chargedNode, "V(a)").empty());
+    chargedNode.setSimulationOptions(SimulationOptions());
+    chargedNode.runTransientAnalysis(1e-3, 0.0, 1e-4);
+    CHECK(!waveform(chargedNode, "V(a)").empty());
+}
+
+// A 1 V AC source in series with a 1 V DC source biases a diode through 1 k. The AC source
+// is zero at DC, so V(b) = 1 V, and the sweep sees the diode as rd = Vt / Id:
+// |V(a)| = rd / (1 k + rd) per volt of AC drive.
+TEST_CASE(acSweepLinearizesDiodeAtBiasPoint) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "AC", "VAC", "in", "0", 1.0);
+    addElement(circuit, "V", "V1", "b", "in", 1.0);
+    addElement(circuit, "R", "R1", "b", "a", 1e3);
+    addElement(circuit, "D", "D1", "a", "0", 0.0);
+    CHECK(circuit.runOperatingPointAnalysis());
+    auto op = circuit.getOperatingPointResults({"V(in)", "V(b)", "V(a)"});
+    CHECK_NEAR(op["V(in)"], 0.0, 1e-12);
+    CHECK_NEAR(op["V(b)"], 1.0, 1e-12);
+    const double Va = op["V(a)"];
+    CHECK_NEAR(Va, 0.5197, 1e-3);
+
+    const double rd = diodeVt / (diodeIs * std::exp(Va / diodeVt));
+    circuit.runACAnalysis(1.0, 10.0, 2);
+    auto sweep = circuit.getACSweepResults({"V(a)"})["V(a)"];
+    CHECK(sweep.size() == 2);
+    for (const auto& [omega, magnitude] : sweep)
+        CHECK_NEAR(magnitude, rd / (1e3 + rd), 1e-4);
+}
+
+// An RC low-pass and an RL branch on a 1 V source: from the operating point the capacitor
+// is charged to 1 V and the inductor carries 0.1 A from the first time point on.
+TEST_CASE(transientStartsFromOperatingPoint) {
+    for (bool fromOperatingPoint : {false, true}) {
+        Circuit circuit;
+        circuit.addGround("0", QPoint());
+        addElement(circuit, "V", "V1", "in", "0", 1.0);
+        addElement(circuit, "R", "R1", "in", "out", 1e3);
+        addElement(circuit, "C", "C1", "out", "0", 1e-6);
+        addElement(circuit, "R", "R2", "in", "m", 10.0);
+        addElement(circuit, "L", "L1", "m", "0", 1e-3);
+        SimulationOptions options;
+        options.transientFromOperatingPoint = fromOperatingPoint;
+        circuit.setSimulationOptions(options);
+        circuit.runTransientAnalysis(1e-3, 0.0, 1e-5);
+        std::map<double, double> out = waveform(circuit, "V(out)");
+        std::map<double, double> inductor = waveform(circuit, "I(L1)");
+        CHECK(!out.empty() && !inductor.empty());
+        if (fromOperatingPoint) {
+            std::map<double, double> steady = {{0.0, 1.0}, {1e-3, 1.0}};
+            CHECK_NEAR(maxDifference(out, steady), 0.0, 1e-6);
+            CHECK_NEAR(std::abs(inductor.begin()->second), 0.1, 1e-6);
+        } else {
+            CHECK(out.begin()->second < 0.05);
+        }
+    }
+}
+// -------------------------------- DC operating point --------------------------------
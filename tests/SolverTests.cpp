@@ -0,0 +1,223 @@
+#include <cmath>
+#include <limits>
+#include "TestSupport.h"
+#include "BlockTriangularSolver.h"
+
+// -------------------------------- Block triangular form --------------------------------
+// Diagonal blocks {0}, {1, 2}, {3}, {4} of a block lower triangular matrix whose rows 3
+// and 4 are swapped, so the maximum transversal has to find the diagonal of both.
+static Eigen::SparseMatrix<double> blockTriangularMatrix() {
+    std::vector<Eigen::Triplet<double>> entries = {
+        {0, 0, 4.0},
+        {1, 0, 1.0}, {1, 1, 3.0}, {1, 2, 1.0},
+        {2, 1, 2.0}, {2, 2, 5.0},
+        {4, 2, 1.0}, {4, 3, 2.0},
+        {3, 0, 1.0}, {3, 3, -1.0}, {3, 4, 6.0},
+    };
+    Eigen::SparseMatrix<double> A(5, 5);
+    A.setFromTriplets(entries.begin(), entries.end());
+    A.makeCompressed();
+    return A;
+}
+
+TEST_CASE(blockTriangularFormFindsDiagonalBlocks) {
+    Eigen::SparseMatrix<double> A = blockTriangularMatrix();
+    std::vector<int> matchedRow;
+    CHECK(BlockTriangularSolver::maximumTransversal(A, matchedRow) == 5);
+
+    BlockTriangularSolver solver;
+    CHECK(solver.analyze(A));
+    CHECK(solver.blockCount() == 4);
+    CHECK(solver.factorize(A));
+
+    Eigen::VectorXd b(5);
+    b << 1.0, -2.0, 3.0, 0.5, 4.0;
+    Eigen::VectorXd x = solver.solve(b);
+    Eigen::VectorXd expected = Eigen::MatrixXd(A).fullPivLu().solve(b);
+    CHECK_NEAR((x - expected).lpNorm<Eigen::Infinity>(), 0.0, 1e-12);
+}
+
+TEST_CASE(blockTriangularFormRejectsStructurallySingularMatrix) {
+    // Column 2 is empty: no transversal covers it.
+    std::vector<Eigen::Triplet<double>> entries = {{0, 0, 1.0}, {1, 1, 1.0}, {2, 0, 1.0}, {2, 1, 1.0}};
+    Eigen::SparseMatrix<double> A(3, 3);
+    A.setFromTriplets(entries.begin(), entries.end());
+    A.makeCompressed();
+    std::vector<int> matchedRow;
+    CHECK(BlockTriangularSolver::maximumTransversal(A, matchedRow) == 2);
+    BlockTriangularSolver solver;
+    CHECK(!solver.analyze(A));
+}
+
+// Divider, VCVS buffer and an RC stage: the controlled sources only couple one way, so
+// the MNA matrix splits into several diagonal blocks. V(c) = 1 - exp(-t / 1 ms), V(d) = -V(c).
+static void buildBufferedRC(Circuit& circuit) {
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 1.0);
+    addElement(circuit, "R", "R1", "in", "a", 1e3);
+    addElement(circuit, "R", "R2", "a", "0", 1e3);
+    addElement(circuit, "E", "E1", "b", "0", 2.0, {}, {"a", "0"});
+    addElement(circuit, "R", "R3", "b", "c", 1e3);
+    addElement(circuit, "C", "C1", "c", "0", 1e-6);
+    addElement(circuit, "E", "E2", "d", "0", -1.0, {}, {"c", "0"});
+    addElement(circuit, "R", "R4", "d", "0", 1e3);
+}
+
+TEST_CASE(blockTriangularFormMatchesPlainLU) {
+    std::map<double, double> results[2];
+    for (bool btf : {false, true}) {
+        Circuit circuit;
+        buildBufferedRC(circuit);
+        SimulationOptions options;
+        options.blockTriangularForm = btf;
+        circuit.setSimulationOptions(options);
+        circuit.runTransientAnalysis(3e-3, 0.0, 1e-5);
+        results[btf] = waveform(circuit, "V(c)");
+        if (btf)
+            CHECK_NEAR(valueAt(waveform(circuit, "V(d)"), 1e-3), -valueAt(results[btf], 1e-3), 1e-12);
+    }
+    // Backward Euler at h = 10 us is within 2e-3 of the exact response.
+    CHECK_NEAR(valueAt(results[true], 1e-3), 1.0 - std::exp(-1.0), 2e-3);
+    CHECK_NEAR(valueAt(results[true], 2.5e-3), 1.0 - std::exp(-2.5), 2e-3);
+    CHECK_NEAR(maxDifference(results[true], results[false]), 0.0, 1e-12);
+}
+// -------------------------------- Block triangular form --------------------------------
+
+
+// -------------------------------- Low-rank updates --------------------------------
+// Tridiagonal matrix with a dominant diagonal; scale multiplies the entries of columns 3 and 7.
+static Eigen::SparseMatrix<double> tridiagonalMatrix(double scale) {
+    const int n = 10;
+    std::vector<Eigen::Triplet<double>> entries;
+    for (int i = 0; i < n; ++i) {
+        double columnScale = (i == 3 || i == 7) ? scale : 1.0;
+        entries.emplace_back(i, i, 4.0 * columnScale);
+        if (i > 0)
+            entries.emplace_back(i - 1, i, -1.0 * columnScale);
+        if (i + 1 < n)
+            entries.emplace_back(i + 1, i, -1.0 * columnScale);
+    }
+    Eigen::SparseMatrix<double> A(n, n);
+    A.setFromTriplets(entries.begin(), entries.end());
+    A.makeCompressed();
+    return A;
+}
+
+static double solveError(MNASolver& solver, const Eigen::SparseMatrix<double>& A) {
+    Eigen::VectorXd b = Eigen::VectorXd::LinSpaced(A.rows(), 1.0, 2.0);
+    Eigen::VectorXd x = solver.solve(b);
+    if (x.size() != b.size())
+        return std::numeric_limits<double>::infinity();
+    return (x - Eigen::MatrixXd(A).fullPivLu().solve(b)).lpNorm<Eigen::Infinity>();
+}
+
+TEST_CASE(lowRankUpdateMatchesRefactorization) {
+    MNASolver solver;
+    solver.setLowRankUpdates(true, 8);
+    CHECK(solver.factorize(tridiagonalMatrix(1.0)));
+    CHECK_NEAR(solveError(solver, tridiagonalMatrix(1.0)), 0.0, 1e-12);
+    // Two changed columns: a Woodbury correction of the first factorization.
+    for (double scale : {1.5, 3.0, 0.6}) {
+        CHECK(solver.factorize(tridiagonalMatrix(scale)));
+        CHECK_NEAR(solveError(solver, tridiagonalMatrix(scale)), 0.0, 1e-12);
+    }
+}
+
+TEST_CASE(failedFactorizationIsNoLowRankBase) {
+    MNASolver solver;
+    solver.setLowRankUpdates(true, 8);
+    CHECK(solver.factorize(tridiagonalMatrix(1.0)));
+    // Zeroed columns make the matrix singular; the next matrix has to be factored anew.
+    CHECK(!solver.factorize(tridiagonalMatrix(0.0)));
+    CHECK(solver.factorize(tridiagonalMatrix(2.0)));
+    CHECK_NEAR(solveError(solver, tridiagonalMatrix(2.0)), 0.0, 1e-12);
+}
+
+// A 30x30 RC mesh driven through a resistor from a sine source and clamped by two
+// antiparallel diodes at the driven corner. Newton only changes the diode columns.
+static std::map<double, double> runClampedMesh(const SimulationOptions& options, const std::string& probe) {
+    const int size = 30;
+    auto node = [](int row, int column) { return "m" + std::to_string(row) + "_" + std::to_string(column); };
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 0.0, {0.0, 5.0, 10e3}, {}, true);
+    addElement(circuit, "R", "RIN", "in", node(0, 0), 100.0);
+    addElement(circuit, "D", "D1", node(0, 0), "0", 0.0);
+    addElement(circuit, "D", "D2", "0", node(0, 0), 0.0);
+    for (int row = 0; row < size; ++row) {
+        for (int column = 0; column < size; ++column) {
+            const std::string here = node(row, column), suffix = std::to_string(row) + "_" + std::to_string(column);
+            addElement(circuit, "C", "C" + suffix, here, "0", 1e-9);
+            if (column + 1 < size)
+                addElement(circuit, "R", "RH" + suffix, here, node(row, column + 1), 1e3);
+            if (row + 1 < size)
+                addElement(circuit, "R", "RV" + suffix, here, node(row + 1, column), 1e3);
+        }
+    }
+
+    circuit.setSimulationOptions(options);
+    circuit.runTransientAnalysis(200e-6, 0.0, 1e-6);
+    return waveform(circuit, probe);
+}
+
+TEST_CASE(lowRankUpdatesMatchFullNewtonOnClampedMesh) {
+    SimulationOptions lowRank;
+    lowRank.lowRankUpdates = true;
+    for (const std::string probe : {"V(m0_0)", "V(m15_15)", "I(V1)"}) {
+        std::map<double, double> full = runClampedMesh(SimulationOptions(), probe);
+        std::map<double, double> updated = runClampedMesh(lowRank, probe);
+        CHECK(!full.empty() && full.rbegin()->first > 198e-6);
+        CHECK_NEAR(maxDifference(updated, full), 0.0, 1e-9);
+    }
+    // The clamp holds the driven corner within a diode drop of ground.
+    std::map<double, double> corner = runClampedMesh(lowRank, "V(m0_0)");
+    double peak = 0.0;
+    for (const auto& point : corner)
+        peak = std::max(peak, std::abs(point.second));
+    CHECK(peak > 0.5 && peak < 1.0);
+}
+// -------------------------------- Low-rank updates --------------------------------
+
+
+// -------------------------------- Mixed-precision LU --------------------------------
+TEST_CASE(mixedPrecisionRefinesToDoubleAccuracy) {
+    // Rows scaled over six decades, like the conductances and unit entries of an MNA matrix.
+    Eigen::SparseMatrix<double> A = tridiagonalMatrix(1.0);
+    for (int k = 0; k < A.outerSize(); ++k)
+        for (Eigen::SparseMatrix<double>::InnerIterator it(A, k); it; ++it)
+            it.valueRef() *= std::pow(10.0, it.row() % 7 - 3);
+    MNASolver solver;
+    solver.setBackend(MNASolver::Backend::MIXED_PRECISION_LU);
+    CHECK(solver.factorize(A));
+    CHECK_NEAR(solveError(solver, A), 0.0, 1e-9);
+}
+
+// [[1, 1], [1, 1 + epsilon]] has a condition number of about 4 / epsilon. Refinement stops
+// once the relative residual meets IterativeSolverSettings::tolerance (1e-10), so the error
+// in x can be up to the condition number times that. At 1e-9 the matrix is singular in
+// single precision and is solved with a double factorization instead.
+TEST_CASE(mixedPrecisionMeetsResidualToleranceOnIllConditionedMatrices) {
+    for (double epsilon : {1e-3, 1e-5, 1e-7, 1e-9}) {
+        std::vector<Eigen::Triplet<double>> entries = {{0, 0, 1.0}, {0, 1, 1.0}, {1, 0, 1.0}, {1, 1, 1.0 + epsilon}};
+        Eigen::SparseMatrix<double> A(2, 2);
+        A.setFromTriplets(entries.begin(), entries.end());
+        A.makeCompressed();
+        MNASolver solver;
+        solver.setBackend(MNASolver::Backend::MIXED_PRECISION_LU);
+        CHECK(solver.factorize(A));
+        Eigen::Vector2d b(2.0, 2.0 + epsilon);
+        Eigen::VectorXd x = solver.solve(b);
+        CHECK(x.size() == 2);
+        CHECK_NEAR((b - A * x).norm() / b.norm(), 0.0, 1e-10);
+        if (epsilon == 1e-9)
+            CHECK_NEAR((x - Eigen::Vector2d(1.0, 1.0)).lpNorm<Eigen::Infinity>(), 0.0, 1e-6);
+    }
+}
+
+TEST_CASE(mixedPrecisionMatchesDoubleLUOnClampedMesh) {
+    SimulationOptions mixed;
+    mixed.linearSolver = MNASolver::Backend::MIXED_PRECISION_LU;
+    for (const std::string probe : {"V(m0_0)", "V(m15_15)"})
+        CHECK_NEAR(maxDifference(runClampedMesh(mixed, probe), runClampedMesh(SimulationOptions(), probe)), 0.0, 1e-8);
+}
+// -------------------------------- Mixed-precision LU --------------------------------
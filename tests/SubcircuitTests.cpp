@@ -0,0 +1,65 @@
+#include <cmath>
+#include "TestSupport.h"
+
+// -------------------------------- Schur complement condensation --------------------------------
+static std::map<double, double> runSubcircuitLadder(bool condense, const std::string& probe) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    SubcircuitDefinition segment;
+    segment.name = "SEG";
+    segment.port1NodeName = "p";
+    segment.port2NodeName = "q";
+    segment.netlist = {"R R1 p m 100", "R R2 m q 100", "C C1 m q 1n"};
+    circuit.subcircuitDefinitions["SEG"] = segment;
+
+    // 200 instances of one definition in a chain, each port node shunted to ground.
+    addElement(circuit, "V", "V1", "n0", "0", 0.0, {0.0, 1.0, 50e3}, {}, true);
+    for (int k = 0; k < 200; ++k) {
+        const std::string from = "n" + std::to_string(k), to = "n" + std::to_string(k + 1);
+        addElement(circuit, "SEG", "X" + std::to_string(k), from, to, 0.0);
+        addElement(circuit, "R", "RS" + std::to_string(k), to, "0", 10e3);
+    }
+    addElement(circuit, "D", "D1", "n200", "0", 0.0);
+
+    SimulationOptions options;
+    options.condenseSubcircuits = condense;
+    circuit.setSimulationOptions(options);
+    circuit.runTransientAnalysis(40e-6, 0.0, 0.2e-6);
+    return waveform(circuit, probe);
+}
+
+TEST_CASE(condensedSubcircuitsMatchFlatSolve) {
+    for (const std::string probe : {"V(n1)", "V(n100)", "V(X150_m)", "I(V1)"}) {
+        std::map<double, double> flat = runSubcircuitLadder(false, probe);
+        std::map<double, double> condensed = runSubcircuitLadder(true, probe);
+        CHECK(flat.size() == 200);
+        CHECK_NEAR(maxDifference(condensed, flat), 0.0, 1e-9);
+    }
+}
+
+// The source's branch row only couples to the ports, so the instance block is singular on
+// its own; the instance has to stay in the global system. V(out) = V(in) - 1 V.
+TEST_CASE(subcircuitWithSourceAcrossPortsSolvesCondensed) {
+    for (bool condense : {false, true}) {
+        Circuit circuit;
+        circuit.addGround("0", QPoint());
+        SubcircuitDefinition shift;
+        shift.name = "SHIFT";
+        shift.port1NodeName = "p";
+        shift.port2NodeName = "q";
+        shift.netlist = {"V VS p q 1", "R R1 p m 100", "R R2 m q 100"};
+        circuit.subcircuitDefinitions["SHIFT"] = shift;
+        addElement(circuit, "V", "V1", "in", "0", 2.0);
+        addElement(circuit, "SHIFT", "X1", "in", "out", 0.0);
+        addElement(circuit, "R", "RL", "out", "0", 1e3);
+
+        SimulationOptions options;
+        options.condenseSubcircuits = condense;
+        circuit.setSimulationOptions(options);
+        circuit.runTransientAnalysis(1e-5, 0.0, 1e-6);
+        std::map<double, double> out = waveform(circuit, "V(out)");
+        CHECK(!out.empty());
+        CHECK_NEAR(valueAt(out, 5e-6), 1.0, 1e-9);
+    }
+}
+// -------------------------------- Schur complement condensation --------------------------------
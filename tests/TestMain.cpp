@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <QDir>
+#include "TestSupport.h"
+
+struct TestCase {
+    std::string name;
+    std::function<void()> run;
+};
+
+static std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+bool registerTestCase(const std::string& name, std::function<void()> run) {
+    testCases().push_back({name, std::move(run)});
+    return true;
+}
+
+void checkNear(double actual, double expected, double tolerance, const char* expression, const char* file, int line) {
+    if (std::abs(actual - expected) <= tolerance)
+        return;
+    std::ostringstream message;
+    message.precision(10);
+    message << file << ":" << line << ": " << expression << " = " << actual << ", expected " << expected << " +- " << tolerance;
+    throw TestFailure{message.str()};
+}
+
+void addElement(Circuit& circuit, const std::string& type, const std::string& name, const std::string& node1, const std::string& node2,
+                double value, const std::vector<double>& numericParams, const std::vector<std::string>& stringParams, bool isSinusoidal) {
+    circuit.addComponent(type, name, node1, node2, QPoint(), true, value, numericParams, stringParams, isSinusoidal);
+}
+
+std::map<double, double> waveform(const Circuit& circuit, const std::string& variable) {
+    auto results = circuit.getTransientResults({variable});
+    auto it = results.find(variable);
+    return it == results.end() ? std::map<double, double>() : it->second;
+}
+
+double valueAt(const std::map<double, double>& wave, double t) {
+    auto after = wave.lower_bound(t);
+    if (after == wave.end())
+        return std::numeric_limits<double>::quiet_NaN();
+    if (after->first == t || after == wave.begin())
+        return after->second;
+    auto before = std::prev(after);
+    double weight = (t - before->first) / (after->first - before->first);
+    return before->second + weight * (after->second - before->second);
+}
+
+double maxDifference(const std::map<double, double>& wave, const std::map<double, double>& reference) {
+    if (wave.empty() || reference.empty())
+        return std::numeric_limits<double>::infinity();
+    double worst = 0.0;
+    for (const auto& [t, value] : wave)
+        worst = std::max(worst, std::abs(value - valueAt(reference, t)));
+    return worst;
+}
+
+// Saved subcircuits go to the temporary directory instead of the application's library.
+QString getSubcircuitLibraryPath() {
+    return QDir::tempPath();
+}
+
+// Runs every test case, or those named as arguments. The simulator's progress messages on
+// std::cout are dropped unless -v is given.
+int main(int argc, char** argv) {
+    bool verbose = false;
+    std::vector<std::string> selected;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "-v")
+            verbose = true;
+        else
+            selected.push_back(argument);
+    }
+
+    std::ostringstream discarded;
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    int failures = 0, ran = 0;
+    for (const auto& testCase : testCases()) {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), testCase.name) == selected.end())
+            continue;
+        ++ran;
+        std::string failure;
+        if (!verbose)
+            std::cout.rdbuf(discarded.rdbuf());
+        try {
+            testCase.run();
+        } catch (const TestFailure& e) {
+            failure = e.message;
+        } catch (const std::exception& e) {
+            failure = std::string("exception: ") + e.what();
+        }
+        std::cout.rdbuf(coutBuffer);
+        discarded.str("");
+        if (failure.empty())
+            std::cerr << "PASS " << testCase.name << std::endl;
+        else {
+            ++failures;
+            std::cerr << "FAIL " << testCase.name << "\n  " << failure << std::endl;
+        }
+    }
+    std::cerr << ran - failures << " of " << ran << " test cases passed." << std::endl;
+    return (failures == 0 && ran > 0) ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#ifndef TESTSUPPORT_H
+#define TESTSUPPORT_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "Circuit.h"
+
+// -------------------------------- Regression checks --------------------------------
+// Each TEST_CASE builds a circuit through the public Circuit API (or a matrix for the
+// solvers) and checks the result against a closed-form value or against the same problem
+// solved another way. A failed CHECK ends its test case; TestMain.cpp runs every case, or
+// the ones named on the command line, and fails if any of them does.
+struct TestFailure {
+    std::string message;
+};
+
+bool registerTestCase(const std::string& name, std::function<void()> run);
+void checkNear(double actual, double expected, double tolerance, const char* expression, const char* file, int line);
+
+#define TEST_CASE(name) \
+    static void name(); \
+    static const bool name##Registered = registerTestCase(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+            throw TestFailure{std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": CHECK(" #condition ") failed"}; \
+    } while (false)
+
+#define CHECK_NEAR(actual, expected, tolerance) checkNear((actual), (expected), (tolerance), #actual, __FILE__, __LINE__)
+
+// Adds a component the way the schematic does, so subcircuit definitions are unrolled.
+void addElement(Circuit& circuit, const std::string& type, const std::string& name, const std::string& node1, const std::string& node2,
+                double value, const std::vector<double>& numericParams = {}, const std::vector<std::string>& stringParams = {},
+                bool isSinusoidal = false);
+
+// One transient waveform ("V(node)" or "I(component)"); empty if the run stored none.
+std::map<double, double> waveform(const Circuit& circuit, const std::string& variable);
+// The waveform at time t, linearly interpolated between the stored points.
+double valueAt(const std::map<double, double>& wave, double t);
+// Largest difference of two waveforms over the time points of the first.
+double maxDifference(const std::map<double, double>& wave, const std::map<double, double>& reference);
+// -------------------------------- Regression checks --------------------------------
+
+#endif // TESTSUPPORT_H
@@ -0,0 +1,142 @@
+#include <cmath>
+#include "TestSupport.h"
+
+// -------------------------------- Adaptive time step --------------------------------
+
+
+// -------------------------------- Integration methods --------------------------------
+// A 1 V pulse into a series RLC (R = 10, L = 1 m, C = 1 u, zeta = 0.16). The pulse corners
+// at 16 us and 32 us lie on every step grid used below, so only the method sets the error.
+static std::map<double, double> runRLCPulse(IntegrationMethod method, double maxTimeStep, bool adaptive = false,
+                                            AnalysisStats* stats = nullptr) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 0.0, {0.0, 1.0, 16e-6, 16e-6, 16e-6, 1.0, 0.0}, {"PULSE"});
+    addElement(circuit, "R", "R1", "in", "a", 10.0);
+    addElement(circuit, "L", "L1", "a", "b", 1e-3);
+    addElement(circuit, "C", "C1", "b", "0", 1e-6);
+    SimulationOptions options;
+    options.integrationMethod = method;
+    options.adaptiveTimeStep = adaptive;
+    circuit.setSimulationOptions(options);
+    circuit.runTransientAnalysis(400e-6, 0.0, maxTimeStep);
+    if (stats)
+        *stats = circuit.getAnalysisStats();
+    return waveform(circuit, "V(b)");
+}
+
+TEST_CASE(integrationMethodsConvergeAtTheirOrder) {
+    std::map<double, double> reference = runRLCPulse(IntegrationMethod::TRAPEZOIDAL, 0.125e-6);
+    const std::pair<IntegrationMethod, double> methods[] = {
+        {IntegrationMethod::BACKWARD_EULER, 2.0}, {IntegrationMethod::TRAPEZOIDAL, 4.0}, {IntegrationMethod::BDF2, 4.0}};
+    for (const auto& [method, ratio] : methods) {
+        // Halving h divides the error by 2^order.
+        double coarse = maxDifference(runRLCPulse(method, 4e-6), reference);
+        double medium = maxDifference(runRLCPulse(method, 2e-6), reference);
+        double fine = maxDifference(runRLCPulse(method, 1e-6), reference);
+        CHECK_NEAR(coarse / medium, ratio, 0.3 * ratio);
+        CHECK_NEAR(medium / fine, ratio, 0.15 * ratio);
+    }
+
+    // The second-order methods need far fewer adaptive steps for a smaller error.
+    AnalysisStats eulerStats, trapezoidalStats;
+    double eulerError = maxDifference(runRLCPulse(IntegrationMethod::BACKWARD_EULER, 1e-5, true, &eulerStats), reference);
+    double trapezoidalError = maxDifference(runRLCPulse(IntegrationMethod::TRAPEZOIDAL, 1e-5, true, &trapezoidalStats), reference);
+    CHECK(3 * trapezoidalStats.acceptedSteps < eulerStats.acceptedSteps);
+    CHECK(trapezoidalError < eulerError);
+}
+// -------------------------------- Integration methods --------------------------------
+// A 1 V step into R = 1 k, C = 1 u: V(out) = 1 - exp(-t / 1 ms).
+static std::map<double, double> runRCStep(const SimulationOptions& options, double maxTimeStep, AnalysisStats* stats = nullptr) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 1.0);
+    addElement(circuit, "R", "R1", "in", "out", 1e3);
+    addElement(circuit, "C", "C1", "out", "0", 1e-6);
+    circuit.setSimulationOptions(options);
+    circuit.runTransientAnalysis(5e-3, 0.0, maxTimeStep);
+    if (stats)
+        *stats = circuit.getAnalysisStats();
+    return waveform(circuit, "V(out)");
+}
+
+static double maxErrorFromRCStep(const std::map<double, double>& wave) {
+    double worst = 0.0;
+    for (const auto& [t, value] : wave)
+        worst = std::max(worst, std::abs(value - (1.0 - std::exp(-t / 1e-3))));
+    return worst;
+}
+
+TEST_CASE(adaptiveStepFollowsTruncationError) {
+    SimulationOptions options;
+    options.adaptiveTimeStep = true;
+    AnalysisStats stats;
+    std::map<double, double> wave = runRCStep(options, 1e-4, &stats);
+    // Short steps where the response bends, then up to the 100 us maximum.
+    CHECK(stats.acceptedSteps < 150);
+    CHECK(std::next(wave.begin())->first <= 1e-5);
+    CHECK_NEAR(maxErrorFromRCStep(wave), 0.0, 7e-3);
+
+    // A tighter tolerance takes more steps for a smaller error.
+    options.truncationRelTol = 1e-4;
+    AnalysisStats tightStats;
+    std::map<double, double> tightWave = runRCStep(options, 1e-4, &tightStats);
+    CHECK(tightStats.acceptedSteps > stats.acceptedSteps);
+    CHECK(maxErrorFromRCStep(tightWave) < 0.5 * maxErrorFromRCStep(wave));
+}
+// -------------------------------- Adaptive time step --------------------------------
+
+
+// -------------------------------- Newton iteration --------------------------------
+// A 0 to 50 V pulse through 1 k into a diode to ground. Without junction limiting the first
+// Newton step at the edge overflows the exponential and the run stops there.
+TEST_CASE(junctionLimitingCarriesDiodeClampThroughPulseEdges) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 0.0, {0.0, 50.0, 10e-6, 1e-6, 1e-6, 20e-6, 50e-6}, {"PULSE"});
+    addElement(circuit, "R", "R1", "in", "out", 1e3);
+    addElement(circuit, "D", "D1", "out", "0", 0.0);
+    circuit.runTransientAnalysis(200e-6, 0.0, 1e-6);
+    std::map<double, double> out = waveform(circuit, "V(out)");
+    CHECK(!out.empty() && out.rbegin()->first > 199e-6);
+
+    // About 50 mA through the diode while the pulse is high, nothing while it is low.
+    CHECK(valueAt(out, 20e-6) > 0.6 && valueAt(out, 20e-6) < 0.7);
+    CHECK_NEAR(valueAt(out, 45e-6), 0.0, 1e-9);
+    AnalysisStats stats = circuit.getAnalysisStats();
+    CHECK(stats.limitedEvaluations > 0);
+    CHECK(stats.newtonIterations < 2 * stats.acceptedSteps);
+}
+
+// A 5 V, 1 kHz half-wave rectifier into 1 k parallel 10 u, 3 ms at 1 us steps.
+static std::map<double, double> runHalfWaveRectifier(bool chord, AnalysisStats& stats) {
+    Circuit circuit;
+    circuit.addGround("0", QPoint());
+    addElement(circuit, "V", "V1", "in", "0", 0.0, {0.0, 5.0, 1e3}, {}, true);
+    addElement(circuit, "D", "D1", "in", "out", 0.0);
+    addElement(circuit, "R", "R1", "out", "0", 1e3);
+    addElement(circuit, "C", "C1", "out", "0", 10e-6);
+    SimulationOptions options;
+    options.chordNewton = chord;
+    circuit.setSimulationOptions(options);
+    circuit.runTransientAnalysis(3e-3, 0.0, 1e-6);
+    stats = circuit.getAnalysisStats();
+    return waveform(circuit, "V(out)");
+}
+
+TEST_CASE(chordNewtonKeepsJacobianOnHalfWaveRectifier) {
+    AnalysisStats fullStats, chordStats;
+    std::map<double, double> full = runHalfWaveRectifier(false, fullStats);
+    std::map<double, double> chord = runHalfWaveRectifier(true, chordStats);
+    CHECK(full.size() == 3000);
+    CHECK_NEAR(valueAt(full, 0.25e-3), 4.3815, 1e-4);
+    CHECK_NEAR(valueAt(full, 1e-3), 4.0853, 1e-4);
+    CHECK_NEAR(maxDifference(chord, full), 0.0, 1e-5);
+
+    // Full Newton factors once per iteration; the chord iteration a handful of times in all,
+    // for more but cheaper iterations. A chord iteration that is let crawl takes over 10x.
+    CHECK(fullStats.jacobianFactorizations == fullStats.newtonIterations);
+    CHECK(chordStats.jacobianFactorizations < 20);
+    CHECK(chordStats.newtonIterations < 5 * fullStats.newtonIterations);
+}
+// -------------------------------- Newton iteration --------------------------------